@@ -168,20 +168,38 @@ static const char cmdHelp[] PROGMEM = {
   "trg:P Send trigger to selected devices (up to 15 addresses)\n"
   "ver:P Display firmware version\n"
   "aspoll:C Serial poll all instruments (alias: ++spoll all)\n"
+  "binrec:C Send readings as timestamped binary records (0=off, 1=on)\n"
+  "capture:C Bus analyzer - send timestamped records of all bus traffic (0=off, 1=on)\n"
+  "cfg:C Save, load, delete or list named configurations (save|load|del name, list)\n"
+  "compress:C Compress data received from the GPIB bus (0=off, 1=on)\n"
   "dcl:C Send unaddressed (all) device clear  [power on reset] (is the rst?)\n"
   "default:C Set configuration to controller default settings\n"
+  "devaddr:C Answer to more than one address in device mode (add addr, del addr, use addr, clr)\n"
+  "hs488:C Use the HS488 high speed handshake with devices that support it (0=off, 1=on [pulse us], talk addr...|all|clr)\n"
   "id:C Show interface ID information - see also: 'id name'; 'id serial'; 'id verstr'\n"
   "id name:C Show/Set the name of the interface\n"
   "id serial:C Show/Set the serial number of the interface\n"
   "id verstr:C Show/Set the version string sent in reply to ++ver e.g. \"GPIB-USB\"). Max 47 chars, excess truncated.\n"
   "idn:C Enable/Disable reply to *idn? (disabled by default)\n"
-  "macro:C Run a macro (if macro support is compiled)\n"
+  "macro:C Run, define, record or list macros (if macro support is compiled)\n"
+  "perf:C Show or clear main loop timing (clr)\n"
+  "poll:C Read instruments on a timed schedule (add addr ms query, del n, clr, start, stop, list)\n"
+  "numfmt:C Return numeric readings as binary float (0=off, 1=float32, 2=float64)\n"
   "ppoll:C Conduct a parallel poll\n"
+  "probe:C Measure an instrument and keep a read profile for it ([addr [query]], list, del addr, clr)\n"
   "ren:C Assert or Unassert the REN signal\n"
   "repeat:C Repeat a given command and return result\n"
+  "resp:C Answer queries in device mode without the host (add query|response, del n, clr, list)\n"
+  "seq:C Build and run a command sequence (add step, run, stop, clr, list, save, load)\n"
   "setvstr:C DEPRECATED - see id verstr\n"
+  "speed:C Show or set bus timing (std, long, short, t1 ns [addr...], eoi us)\n"
   "srqauto:C Automatically conduct serial poll when SRQ is asserted\n"
+  "stats:C Show or clear handshake timing and per-address transfer statistics (clr)\n"
+  "term:C Show or set a custom read terminator (eor, seq byte [byte...], set byte [byte...])\n"
+  "tmo_us:C Show or set first byte, inter-byte and total read timeouts in microseconds (0=default)\n"
+  "trace:C Send the trace buffer in binary (clr to clear)\n"
   "ton:C Put controller in talk-only mode (send data only)\n"
+  "txfifo:C Show or clear the device mode output FIFO (clr)\n"
   "verbose:C Verbose (human readable) mode\n"
   "xdiag:C Bus diagnostics (see the doc)\n"
 };
@@ -240,6 +258,33 @@ uint8_t isTO = 0;
 
 bool isProm = false;
 
+// Bus analyzer capture mode flag
+#ifdef USE_ANALYZER
+bool isCapture = false;
+#endif
+
+// Main loop profiler (times in microseconds)
+#ifdef USE_PERF
+#define PERF_CMD 0          // Macros and command execution
+#define PERF_CTRL 1         // Controller mode: send, auto-read, sequencer, poller
+#define PERF_DEVICE 2       // Device mode: ATN handling, lon, ton
+#define PERF_SERIAL 3       // IDN reply and serial input
+#define PERF_SECTIONS 4
+#define PERF_LOOP() perfLoop()
+#define PERF_MARK(sect) perfMark(sect)
+uint32_t perfTotal[PERF_SECTIONS];  // Total time spent in each section
+uint32_t perfPeak[PERF_SECTIONS];   // Longest time spent in each section
+uint32_t perfLoops = 0;             // Number of loop periods measured
+uint32_t perfSum = 0;               // Sum of loop periods
+uint32_t perfMin = 0xFFFFFFFF;      // Shortest loop period
+uint32_t perfMax = 0;               // Longest loop period
+unsigned long perfLoopStart = 0;    // Start of the current loop
+unsigned long perfSectStart = 0;    // Start of the current section
+#else
+#define PERF_LOOP()
+#define PERF_MARK(sect)
+#endif
+
 
 // Data send mode flags
 bool dataBufferFull = false;    // Flag when parse buffer is full
@@ -257,9 +302,63 @@ bool isSrqa = false;
 // Whether to run Macro 0 (macros must be enabled)
 uint8_t runMacro = 0;
 
+// Macro being recorded (10 = not recording)
+uint8_t macroRec = 10;
+
+// Command sequence running (sequencer must be enabled)
+bool seqRun = false;
+
+// Timed acquisition running (poller must be enabled)
+bool pollRun = false;
+
 // Send response to *idn?
 bool sendIdn = false;
 
+// Wrap readings in timestamped binary records
+bool isBinRec = false;
+RECSTREAM recStream;
+
+// Convert numeric readings to binary (0=off, 1=float32, 2=float64)
+#ifdef USE_NUMCONV
+uint8_t numFmt = 0;
+NUMSTREAM numStream;
+#endif
+
+// Compress data received from the bus
+#ifdef USE_COMPRESSION
+bool isCompress = false;
+ZSTREAM zStream;
+#endif
+
+// Device mode output FIFO
+#define NO_SLOT 0xFF                // devFind(): not one of our addresses
+#ifdef USE_TXFIFO
+#define TXFIFO_MASK (TXFIFO_SIZE - 1)
+#define XON 0x11
+#define XOFF 0x13
+uint8_t txFifo[DEV_ADDRS][TXFIFO_SIZE];     // Data waiting to be sent to the controller
+uint8_t txEom[DEV_ADDRS][TXFIFO_SIZE / 8];  // Bitmap of the bytes that end a message
+uint16_t txHead[DEV_ADDRS];         // Next byte to send
+uint16_t txTail[DEV_ADDRS];         // Next free position
+uint16_t txLost[DEV_ADDRS];         // Lines discarded because the FIFO was full
+bool txOpen[DEV_ADDRS];             // Last data queued did not end the message
+bool txXoff = false;                // XOFF has been sent to the host
+// Addresses answered to in device mode (slot 0 is ++addr, 0 = unused)
+uint8_t devAddr[DEV_ADDRS];         // Address of each slot
+uint8_t devStat[DEV_ADDRS];         // Status byte of each slot (slot 0 uses cfg.stat)
+uint8_t devSel = 0;                 // Slot receiving data from the host
+uint8_t devTalk = 0;                // Slot last addressed to talk
+uint8_t devListen = 0;              // Slot last addressed to listen
+#endif
+
+// Device mode replies sent without the host
+#ifdef USE_RESPONDER
+char respQry[RESP_ENTRIES][RESP_QLEN + 1];  // Queries answered by the interface ("" = unused)
+char respTxt[RESP_ENTRIES][RESP_RLEN + 1];  // Response to each query
+uint8_t respPending[DEV_ADDRS];     // Entry + 1 to send when the slot is addressed to talk (0 = none)
+QRYSTREAM qryStream;
+#endif
+
 // Xon/Xoff flag (off by default)
 //bool xonxoff = false;
 
@@ -341,20 +440,8 @@ void setup() {
 
   // Using MCP23017 (I2C) expander chip
 #ifdef AR488_MCP23017
-  // Start I2C
-  Wire.begin();
-  // OPtional: Set the I2C bus clock frequency in Hertz (optional - 10000 [slow], 100000 [standard], 400000 [fast], 3400000 [fast plus])
-  // Check processor documentation for which modes are supported
-//  Wire.setClock(100000);
-
-  // Set expander configuration register
-  // (Bit 1=0 sets active low for Int A)
-  // (Bit 3 is not relevant for the 23017)
-  // (Bit 7=0 sets registers to be in same bank)
-  mcpByteWrite(MCPCON, 0b00000000);
-
-  // Enable MCP23017 interrupts
-  mcpInterruptsEn();
+  // Start I2C and initialise the MCP chip
+  mcpInit();
   // Attach interrupt handler to Arduino board pin for MCP23S17 to signal interrupt has occurred
   attachInterrupt(digitalPinToInterrupt(MCP_INTERRUPT), mcpIntHandler, FALLING);
 #endif
@@ -380,18 +467,17 @@ void setup() {
 
 #ifdef E2END
 //  DB_RAW_PRINTLN(F("EEPROM detected!"));
-  // Read data from non-volatile memory
+  // Read the startup configuration from its EEPROM slot
   //(will only read if previous config has already been saved)
-  if (!isEepromClear()) {
+  if (!epSlotRead(EESLOT_STARTUP, gpibBus.cfg.db, GPIB_CFG_SIZE)) {
+    // Otherwise read config saved by earlier firmware versions
+    if (!isEepromClear()) {
 //DB_RAW_PRINTLN(F("EEPROM has data."));
-    if (!epReadData(gpibBus.cfg.db, GPIB_CFG_SIZE)) {
-      // CRC check failed - config data does not match EEPROM
-//DB_RAW_PRINTLN(F("CRC check failed. Erasing EEPROM...."));
-      epErase();
-      gpibBus.setDefaultCfg();
-//      initAR488();
-      epWriteData(gpibBus.cfg.db, GPIB_CFG_SIZE);
-//DB_RAW_PRINTLN(F("EEPROM data set to default."));
+      if (!epReadData(gpibBus.cfg.db, GPIB_CFG_SIZE)) {
+        // CRC check failed - config data does not match EEPROM
+        // (slots follow the legacy config so the EEPROM is not erased)
+        gpibBus.setDefaultCfg();
+      }
     }
   }
 #endif
@@ -402,6 +488,9 @@ void setup() {
   #ifdef SN7516X_DC
     pinMode(SN7516X_DC, OUTPUT);
   #endif
+  #ifdef SN7516X_SC
+    pinMode(SN7516X_SC, OUTPUT);
+  #endif
   if (gpibBus.cfg.cmode==2) {
     // Set controller mode on SN75161/2
     digitalWrite(SN7516X_TE, LOW);
@@ -451,6 +540,8 @@ void loop() {
 
   bool errFlg = false; 
 
+  PERF_LOOP();
+
 /*** Macros ***/
 /*
  * Run the startup macro if enabled
@@ -482,6 +573,16 @@ if (lnRdy>0){
 }
 */
 
+#ifdef USE_SEQUENCER
+  // Any input from the host stops a running sequence
+  if (seqRun && lnRdy) seqStop(F("Sequence stopped."));
+#endif
+
+#if defined(USE_MACROS) && defined(E2END)
+  // Macro recorder running? Store the line before it is processed
+  if ( (macroRec < 10) && ((lnRdy == 1) || (lnRdy == 2)) ) recordMacro(pBuf, pbPtr);
+#endif
+
   // lnRdy=1: received a command so execute it...
   if (lnRdy == 1) {
     if (autoRead) {
@@ -492,6 +593,8 @@ if (lnRdy>0){
     execCmd(pBuf, pbPtr);
   }
 
+  PERF_MARK(PERF_CMD);
+
   // Controller mode:
   if (gpibBus.isController()) {
     // lnRdy=2: received data - send it to the instrument...
@@ -500,16 +603,26 @@ if (lnRdy>0){
       // Auto-read data from GPIB bus following any command
       if (gpibBus.cfg.amode == 1) {
         //        delay(10);
-        errFlg = gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
+        errFlg = readFromInstrument(gpibBus.cfg.eoi, false, 0);
       }
       // Auto-receive data from GPIB bus following a query command
       if (gpibBus.cfg.amode == 2 && isQuery) {
         //        delay(10);
-        errFlg = gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
+        errFlg = readFromInstrument(gpibBus.cfg.eoi, false, 0);
         isQuery = false;
       }
     }
 
+#ifdef USE_SEQUENCER
+    // Run the next step of the sequence
+    if (seqRun && (lnRdy == 0)) seqStep();
+#endif
+
+#ifdef USE_POLLER
+    // Read instruments that are due
+    if (pollRun && (lnRdy == 0)) pollService();
+#endif
+
     // Automatic serial poll (check status of SRQ and SPOLL if asserted)?
 //    if (isSrqa) {
 //      if (gpibBus.isAsserted(SRQ)) spoll_h(NULL);
@@ -519,7 +632,7 @@ if (lnRdy>0){
     if ((gpibBus.cfg.amode==3) && autoRead) {
       // Nothing is waiting on the serial input so read data from GPIB
       if (lnRdy==0) {
-        errFlg = gpibBus.receiveData(dataPort, readWithEoi, readWithEndByte, endByte);
+        errFlg = readFromInstrument(readWithEoi, readWithEndByte, endByte);
       }
 /*      
       else{
@@ -537,6 +650,8 @@ if (lnRdy>0){
     }
   }
 
+  PERF_MARK(PERF_CTRL);
+
   // Device mode:
   if (gpibBus.isController()==false) {
     if (isTO>0) {
@@ -544,6 +659,10 @@ if (lnRdy>0){
       tonMode();
     }else if (isRO) {
       lonMode();
+#ifdef USE_ANALYZER
+    }else if (isCapture) {
+      captureMode();
+#endif
     }else if (gpibBus.isAsserted(ATN)) {
 //      dataPort.println(F("Attention signal detected"));
       attnRequired();
@@ -554,6 +673,11 @@ if (lnRdy>0){
     if (isProm) {
       if (lnRdy == 2) flushPbuf();
     }
+
+#ifdef USE_TXFIFO
+    // Queue data from the host until the controller asks for it
+    if ( (lnRdy == 2) && (isTO == 0) && !isRO && !isProm ) txQueue(pBuf, pbPtr);
+#endif
       
 /*    
     else{
@@ -562,6 +686,8 @@ if (lnRdy>0){
 */
   }
 
+  PERF_MARK(PERF_DEVICE);
+
   // Reset line ready flag
 //  lnRdy = 0;
 
@@ -583,10 +709,63 @@ if (lnRdy>0){
   if (dataPort.available()) lnRdy = serialIn_h();
 
   delayMicroseconds(5);
+
+  PERF_MARK(PERF_SERIAL);
 }
 /***** END MAIN LOOP *****/
 
 
+/***** Main loop profiler *****/
+#ifdef USE_PERF
+
+/***** Start of loop - record the period since the last one *****/
+void perfLoop() {
+  unsigned long now = micros();
+  uint32_t period = now - perfLoopStart;
+  if (perfLoopStart) {
+    // Keep the sums from overflowing. The section totals add up to the
+    // loop periods, so halving them together keeps their proportions.
+    if (perfSum > 0xF0000000) {
+      perfSum = perfSum >> 1;
+      perfLoops = perfLoops >> 1;
+      for (uint8_t i = 0; i < PERF_SECTIONS; i++) {
+        perfTotal[i] = perfTotal[i] >> 1;
+      }
+    }
+    perfSum += period;
+    perfLoops++;
+    if (period < perfMin) perfMin = period;
+    if (period > perfMax) perfMax = period;
+  }
+  perfLoopStart = now;
+  perfSectStart = now;
+}
+
+
+/***** End of a section - add the time since the last mark *****/
+void perfMark(uint8_t sect) {
+  unsigned long now = micros();
+  uint32_t elapsed = now - perfSectStart;
+  perfTotal[sect] += elapsed;
+  if (elapsed > perfPeak[sect]) perfPeak[sect] = elapsed;
+  perfSectStart = now;
+}
+
+
+/***** Clear the profile *****/
+void perfClear() {
+  memset(perfTotal, 0, sizeof(perfTotal));
+  memset(perfPeak, 0, sizeof(perfPeak));
+  perfLoops = 0;
+  perfSum = 0;
+  perfMin = 0xFFFFFFFF;
+  perfMax = 0;
+  perfLoopStart = 0;
+}
+
+#endif
+
+
 /***** Initialise the interface *****/
 /*
 void initAR488() {
@@ -673,6 +852,10 @@ uint8_t parseInput(char c) {
           // Carriage return on blank line?
           // Note: for data CR and LF will always be escaped
           if (pbPtr == 0) {
+#ifdef USE_TXFIFO
+            // Terminator straight after a full buffer ends the message in the output FIFO
+            if (txOpen[devSel] && !gpibBus.isController()) return 2;
+#endif
             flushPbuf();
             if (isVerb) {
               dataPort.println();
@@ -828,15 +1011,21 @@ static cmdRec cmdHidx [] = {
   { "addr",        3, addr_h      }, 
   { "allspoll",    2, (void(*)(char*)) aspoll_h  },
   { "auto",        2, amode_h     },
+  { "binrec",      2, binrec_h    },
+  { "capture",     1, capture_h   },
+  { "cfg",         3, cfg_h       },
   { "clr",         2, (void(*)(char*)) clr_h     },
+  { "compress",    3, compress_h  },
   { "dcl",         2, (void(*)(char*)) dcl_h     },
   { "default",     3, (void(*)(char*)) default_h },
+  { "devaddr",     1, devaddr_h   },
   { "eoi",         3, eoi_h       },
   { "eor",         3, eor_h       },
   { "eos",         3, eos_h       },
   { "eot_char",    3, eot_char_h  },
   { "eot_enable",  3, eot_en_h    },
   { "help",        3, help_h      },
+  { "hs488",       3, hs488_h     },
   { "ifc",         2, (void(*)(char*)) ifc_h     },
   { "id",          3, id_h        },
   { "idn",         3, idn_h       },
@@ -848,21 +1037,33 @@ static cmdRec cmdHidx [] = {
   { "mode" ,       3, cmode_h     },
   { "msa",         2, sendmsa_h   },
   { "mta",         2, (void(*)(char*)) sendmta_h },
+  { "numfmt",      2, numfmt_h    },
+  { "perf",        3, perf_h      },
+  { "poll",        2, poll_h      },
   { "ppoll",       2, (void(*)(char*)) ppoll_h   },
+  { "probe",       2, probe_h     },
   { "prom",        1, prom_h      },
   { "read",        2, read_h      },
   { "read_tmo_ms", 2, rtmo_h      },
   { "ren",         2, ren_h       },
   { "repeat",      2, repeat_h    },
+  { "resp",        1, resp_h      },
   { "rst",         3, (void(*)(char*)) rst_h     },
+  { "seq",         2, seq_h       },
   { "trg",         2, trg_h       },
   { "savecfg",     3, (void(*)(char*)) save_h    },
   { "setvstr",     3, setvstr_h   },
+  { "speed",       3, speed_h     },
   { "spoll",       2, spoll_h     },
   { "srq",         2, (void(*)(char*)) srq_h     },
   { "srqauto",     2, srqa_h      },
+  { "stats",       3, stats_h     },
   { "status",      1, stat_h      },
+  { "term",        2, term_h      },
+  { "tmo_us",      3, tmous_h     },
+  { "txfifo",      1, txfifo_h    },
   { "ton",         1, ton_h       },
+  { "trace",       3, trace_h     },
   { "unl",         2, (void(*)(char*)) unlisten_h  },
   { "unt",         2, (void(*)(char*)) untalk_h    },
   { "ver",         3, ver_h       },
@@ -919,6 +1120,58 @@ void sendToInstrument(char *buffr, uint8_t dsize) {
 }
 
 
+/***** Read data from the instrument *****/
+/*
+ * Numbers are converted to binary when enabled by ++numfmt, data is
+ * compressed when enabled by ++compress and is wrapped in timestamped
+ * binary records when enabled by ++binrec. The read profile kept by
+ * ++probe for the instrument is used if there is one.
+ */
+bool readFromInstrument(bool detectEoi, bool detectEndByte, uint8_t endByte) {
+  Stream * output = &dataPort;
+  bool err;
+#ifdef USE_PROBE
+  uint8_t eor = gpibBus.cfg.eor;
+  uint32_t tmoNext = gpibBus.tmoNext;
+  bool isProfile = probeApply(gpibBus.cfg.paddr);
+#endif
+
+  if (isBinRec) {
+    recStream.begin(*output, gpibBus.cfg.paddr);
+    output = &recStream;
+  }
+#ifdef USE_COMPRESSION
+  if (isCompress) {
+    zStream.begin(*output);
+    output = &zStream;
+  }
+#endif
+#ifdef USE_NUMCONV
+  if (numFmt) {
+    numStream.begin(*output, numFmt);
+    output = &numStream;
+  }
+#endif
+
+  err = gpibBus.receiveData(*output, detectEoi, detectEndByte, endByte);
+
+#ifdef USE_NUMCONV
+  if (numFmt) numStream.end();
+#endif
+#ifdef USE_COMPRESSION
+  if (isCompress) zStream.end();
+#endif
+  if (isBinRec) recStream.end(gpibBus.rxFlags);
+#ifdef USE_PROBE
+  if (isProfile) {
+    gpibBus.cfg.eor = eor;
+    gpibBus.tmoNext = tmoNext;
+  }
+#endif
+  return err;
+}
+
+
 /***** Execute a command *****/
 void execCmd(char *buffr, uint8_t dsize) {
 //char line[PBSIZE];
@@ -1091,10 +1344,21 @@ void execMacro(uint8_t idx) {
   char c;
   const char * macro = pgm_read_word(macros + idx);
   int ssize = strlen_P(macro);
+#ifdef E2END
+  uint16_t eaddr = 0;
+  uint16_t esize = 0;
+  // A macro stored in EEPROM replaces the compiled-in macro
+  bool inEeprom = epMacroFind(idx, eaddr, esize);
+  if (inEeprom) ssize = esize;
+#endif
 
   // Read characters from macro character array
   for (int i = 0; i < ssize; i++) {
+#ifdef E2END
+    c = inEeprom ? epMacroChar(eaddr + i) : pgm_read_byte_near(macro + i);
+#else
     c = pgm_read_byte_near(macro + i);
+#endif
     if (c == CR || c == LF || i == (ssize - 1)) {
       // Reached terminator or end of marcro. Add to buffer before processing
       if (i == ssize-1) {
@@ -1129,919 +1393,2782 @@ void execMacro(uint8_t idx) {
   // Clear the buffer ready for serial input
   flushPbuf();
 }
-#endif
-
 
-/*************************************/
-/***** STANDARD COMMAND HANDLERS *****/
-/*************************************/
 
-/***** Show or change device address *****/
-void addr_h(char *params) {
-  //  char *param, *stat;
-//  char *param;
-  uint16_t val;
-  if (params != NULL) {
+/***** Print the text of a macro *****/
+void showMacro(uint8_t idx) {
+  const char * macro = pgm_read_word(macros + idx);
+  int ssize = strlen_P(macro);
+  char c = 0;
+#ifdef E2END
+  uint16_t eaddr = 0;
+  uint16_t esize = 0;
+  bool inEeprom = epMacroFind(idx, eaddr, esize);
+  if (inEeprom) ssize = esize;
+#endif
 
-    // Primary address
-//    param = strtok(params, " \t");
-//    if (notInRange(param, 1, 30, val)) return;
-    if (notInRange(params, 1, 30, val)) return;
-    if (val == gpibBus.cfg.caddr) {
-      errBadCmd();
-      if (isVerb) dataPort.println(F("That is my address! Address of a remote device is required."));
-      return;
-    }
-    gpibBus.cfg.paddr = val;
-    if (isVerb) {
-      dataPort.print(F("Set device primary address to: "));
-      dataPort.println(val);
+  for (int i = 0; i < ssize; i++) {
+#ifdef E2END
+    c = inEeprom ? epMacroChar(eaddr + i) : pgm_read_byte_near(macro + i);
+#else
+    c = pgm_read_byte_near(macro + i);
+#endif
+    if (c == LF) {
+      dataPort.println();
+    }else if (c != CR) {
+      dataPort.print(c);
     }
-  } else {
-    dataPort.println(gpibBus.cfg.paddr);
   }
+  if ( (ssize > 0) && (c != LF) ) dataPort.println();
 }
 
 
-/***** Show or set read timout *****/
-void rtmo_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 1, 32000, val)) return;
-    gpibBus.cfg.rtmo = val;
-    if (isVerb) {
-      dataPort.print(F("Set [read_tmo_ms] to: "));
-      dataPort.print(val);
-      dataPort.println(F(" milliseconds"));
-    }
-  } else {
-    dataPort.println(gpibBus.cfg.rtmo);
+/***** Add a line to the macro being recorded *****/
+/*
+ * ++macro commands are executed but not recorded
+ */
+#ifdef E2END
+void recordMacro(char *buffr, uint8_t dsize) {
+  if (strncasecmp(buffr, "++macro", 7) == 0) return;
+  if ( !epMacroAppend(macroRec, buffr, dsize) || !epMacroAppend(macroRec, "\n", 1) ) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("Macro space full - recording stopped!"));
+    macroRec = 10;
   }
 }
+#endif
+#endif
 
 
-/***** Show or set end of send character *****/
-void eos_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 3, val)) return;
-    gpibBus.cfg.eos = (uint8_t)val;
-    if (isVerb) {
-      dataPort.print(F("Set EOS to: "));
-      dataPort.println(val);
-    };
-  } else {
-    dataPort.println(gpibBus.cfg.eos);
-  }
-}
+/***** Command sequencer *****/
+/*
+ * The sequence is held in seqProg as bytecode: each step is an opcode
+ * followed by its arguments. Words are stored low byte first. One step
+ * is executed per pass through the main loop, so waits do not block
+ * and any input from the serial port stops the sequence.
+ */
+#ifdef USE_SEQUENCER
+
+#define SQ_END   0x00   // End of sequence
+#define SQ_SEND  0x01   // Send to instrument [len][chars]
+#define SQ_READ  0x02   // Read from instrument [tag]
+#define SQ_SRQ   0x03   // Wait for SRQ [timeout ms] (0 = no timeout)
+#define SQ_DELAY 0x04   // Wait [ms]
+#define SQ_LOOP  0x05   // Start of loop [count] (0 = repeat until stopped)
+#define SQ_NEXT  0x06   // End of loop
+#define SQ_TRG   0x07   // Trigger instrument
+#define SQ_ADDR  0x08   // Set instrument address [addr]
+#define SQ_SPOLL 0x09   // Serial poll instrument [tag]
+
+#define SEQ_LOOPS 4     // Maximum depth of nested loops
+
+/***** Sequencer step record *****/
+/*
+ * Argument type: 0=none; 1=byte; 2=word; 3=string
+ */
+struct seqRec {
+  const char* token;
+  uint8_t op;
+  uint8_t argtype;
+  uint16_t minval;
+  uint16_t maxval;
+};
 
+static seqRec seqIdx [] = {
+  { "send",  SQ_SEND,  3, 0, 0     },
+  { "read",  SQ_READ,  1, 0, 255   },
+  { "srq",   SQ_SRQ,   2, 0, 30000 },
+  { "delay", SQ_DELAY, 2, 0, 30000 },
+  { "loop",  SQ_LOOP,  2, 0, 30000 },
+  { "next",  SQ_NEXT,  0, 0, 0     },
+  { "trg",   SQ_TRG,   0, 0, 0     },
+  { "addr",  SQ_ADDR,  1, 1, 30    },
+  { "spoll", SQ_SPOLL, 1, 0, 255   }
+};
 
-/***** Show or set EOI assertion on/off *****/
-void eoi_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 1, val)) return;
-    gpibBus.cfg.eoi = val ? true : false;
-    if (isVerb) {
-      dataPort.print(F("Set EOI assertion: "));
-      dataPort.println(val ? "ON" : "OFF");
-    };
-  } else {
-    dataPort.println(gpibBus.cfg.eoi);
-  }
-}
+uint8_t seqProg[SEQ_SIZE] = {SQ_END};
+uint16_t seqLen = 0;              // Length of the sequence (excluding SQ_END)
+uint16_t seqPc = 0;               // Current step
+bool seqWait = false;             // Waiting on SRQ or delay
+unsigned long seqTmr = 0;         // Start of wait
+uint8_t seqSp = 0;                // Loop stack pointer
+uint16_t seqLpc[SEQ_LOOPS];       // Loop start
+uint16_t seqLcnt[SEQ_LOOPS];      // Loop count remaining
 
 
-/***** Show or set interface to controller/device mode *****/
-void cmode_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 1, val)) return;
-    switch (val) {
-      case 0:
-        gpibBus.startDeviceMode();
-        break;
-      case 1:
-        gpibBus.startControllerMode();
-        break;
-    }
-    if (isVerb) {
-      dataPort.print(F("Interface mode set to: "));
-      dataPort.println(val ? "CONTROLLER" : "DEVICE");
-    }
-  } else {
-    dataPort.println(gpibBus.isController());
+/***** Find the step record for an opcode *****/
+/*
+ * Returns the index into seqIdx or 0xFF if not found
+ */
+uint8_t seqFind(uint8_t op) {
+  for (uint8_t i = 0; i < (sizeof(seqIdx) / sizeof(seqIdx[0])); i++) {
+    if (seqIdx[i].op == op) return i;
   }
+  return 0xFF;
 }
 
 
-/***** Show or enable/disable sending of end of transmission character *****/
-void eot_en_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 1, val)) return;
-    gpibBus.cfg.eot_en = val ? true : false;
-    if (isVerb) {
-      dataPort.print(F("Appending of EOT character: "));
-      dataPort.println(val ? "ON" : "OFF");
-    }
-  } else {
-    dataPort.println(gpibBus.cfg.eot_en);
+/***** Size of a step in bytes (0 = invalid step) *****/
+uint16_t seqStepSize(uint16_t pc) {
+  uint8_t i = seqFind(seqProg[pc]);
+  if (i == 0xFF) return 0;
+  switch (seqIdx[i].argtype) {
+    case 1:  return 2;
+    case 2:  return 3;
+    case 3:  return seqProg[pc+1] + 2;
+    default: return 1;
   }
 }
 
 
-/***** Show or set end of transmission character *****/
-void eot_char_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 255, val)) return;
-    gpibBus.cfg.eot_ch = (uint8_t)val;
-    if (isVerb) {
-      dataPort.print(F("EOT set to ASCII character: "));
-      dataPort.println(val);
-    };
-  } else {
-    dataPort.println(gpibBus.cfg.eot_ch, DEC);
+/***** Check that the steps fit the sequence length *****/
+bool seqIsValid() {
+  uint16_t pc = 0;
+  uint16_t ssize;
+  while (pc < seqLen) {
+    ssize = seqStepSize(pc);
+    if (ssize == 0) return false;
+    pc += ssize;
   }
+  return (pc == seqLen);
 }
 
 
-/***** Show or enable/disable auto mode *****/
-void amode_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 3, val)) return;
-    if (val > 0 && isVerb) {
-      dataPort.println(F("WARNING: automode ON can cause some devices to generate"));
-      dataPort.println(F("         'addressed to talk but nothing to say' errors"));
-    }
-    gpibBus.cfg.amode = (uint8_t)val;
-    if (gpibBus.cfg.amode < 3) autoRead = false;
-    if (isVerb) {
-      dataPort.print(F("Auto mode: "));
-      dataPort.println(gpibBus.cfg.amode);
-    }
-  } else {
-    dataPort.println(gpibBus.cfg.amode);
-  }
+/***** Read a word argument *****/
+uint16_t seqWord(uint16_t pc) {
+  return seqProg[pc] | (seqProg[pc+1] << 8);
 }
 
 
-/***** Display the controller version string *****/
-void ver_h(char *params) {
-  // If "real" requested
-  if (params != NULL && strncasecmp(params, "real", 3) == 0) {
-    dataPort.println(F(FWVER));
-    // Otherwise depends on whether we have a custom string set
-  } else {
-    if (strlen(gpibBus.cfg.vstr) > 0) {
-      dataPort.println(gpibBus.cfg.vstr);
-    } else {
-      dataPort.println(F(FWVER));
-    }
-  }
+/***** Stop the sequence and report why *****/
+void seqStop(const __FlashStringHelper *msg) {
+  seqRun = false;
+  seqWait = false;
+  if (isVerb) dataPort.println(msg);
 }
 
 
-/***** Address device to talk and read the sent data *****/
-void read_h(char *params) {
-  // Clear read flags
-  readWithEoi = false;
-  readWithEndByte = false;
-  endByte = 0;
-  // Read any parameters
-  if (params != NULL) {
-    if (strlen(params) > 3) {
-      if (isVerb) dataPort.println(F("Invalid parameter - ignored!"));
-    } else if (strncasecmp(params, "eoi", 3) == 0) { // Read with eoi detection
-      readWithEoi = true;
-    } else { // Assume ASCII character given and convert to an 8 bit byte
-      readWithEndByte = true;
-      endByte = atoi(params);
-    }
-  }
-
-//DB_PRINT(F("readWithEoi:     "), readWithEoi);
-//DB_PRINT(F("readWithEndByte: "), readWithEndByte);
-
-  if (gpibBus.cfg.amode == 3) {
-    // In auto continuous mode we set this flag to indicate we are ready for continuous read
-    autoRead = true;
-  } else {
-    // If auto mode is disabled we do a single read
-    gpibBus.addressDevice(gpibBus.cfg.paddr, TALK);
-    gpibBus.receiveData(dataPort, readWithEoi, readWithEndByte, endByte);
-  }
-}
-
-
-/***** Send device clear (usually resets the device to power on state) *****/
-void clr_h() {
-  if (gpibBus.sendSDC())  {
-    if (isVerb) dataPort.println(F("Failed to send SDC"));
-    return;
-  }
-  // Set GPIB controls back to idle state
-  gpibBus.setControls(CIDS);
-}
+/***** Execute the current step of the sequence *****/
+void seqStep() {
+  uint8_t op = seqProg[seqPc];
+  uint16_t val = 0;
+  char addr[3];
 
+  switch (op) {
 
-/***** Send local lockout command *****/
-void llo_h(char *params) {
-  // NOTE: REN *MUST* be asserted (LOW)
-  if (digitalRead(REN)==LOW) {
-    // For 'all' send LLO to the bus without addressing any device
-    // Devices will show REM as soon as they are addressed and need to be released with LOC
-    if (params != NULL) {
-      if (0 == strncmp(params, "all", 3)) {
-        if (gpibBus.sendCmd(GC_LLO)) {
-          if (isVerb) dataPort.println(F("Failed to send universal LLO."));
-        }
+    case SQ_SEND:
+      val = seqProg[seqPc+1];
+      gpibBus.addressDevice(gpibBus.cfg.paddr, LISTEN);
+      gpibBus.sendData((char *)&seqProg[seqPc+2], val);
+      gpibBus.unAddressDevice();
+      seqPc += val + 2;
+      break;
+
+    case SQ_READ:
+      // Tag the result so that the host can identify it
+      if (!isBinRec) {
+        dataPort.print(seqProg[seqPc+1]);
+        dataPort.print(':');
       }
-    } else {
-      // Send LLO to currently addressed device
-      if (gpibBus.sendLLO()){
-        if (isVerb) dataPort.println(F("Failed to send LLO!"));
+      if (readFromInstrument(gpibBus.cfg.eoi, false, 0) && !isBinRec) dataPort.println();
+      seqPc += 2;
+      break;
+
+    case SQ_SRQ:
+    case SQ_DELAY:
+      val = seqWord(seqPc+1);
+      if (!seqWait) {
+        seqTmr = millis();
+        seqWait = true;
       }
-    }
-  }
-  // Set GPIB controls back to idle state
-  gpibBus.setControls(CIDS);
-}
-
+      if (op == SQ_SRQ) {
+        if (gpibBus.isAsserted(SRQ)) {
+          seqWait = false;
+        }else if ( (val > 0) && ((millis() - seqTmr) >= val) ) {
+          dataPort.println(F("SRQ timeout"));
+          seqStop(F("Sequence stopped."));
+          return;
+        }
+      }else{
+        if ((millis() - seqTmr) >= val) seqWait = false;
+      }
+      if (!seqWait) seqPc += 3;
+      break;
 
-/***** Send Go To Local (GTL) command *****/
-void loc_h(char *params) {
-  // REN *MUST* be asserted (LOW)
-  if (digitalRead(REN)==LOW) {
-    if (params != NULL) {
-      if (strncmp(params, "all", 3) == 0) {
-        // Send request to clear all devices to local
-        gpibBus.sendAllClear();
+    case SQ_LOOP:
+      if (seqSp == SEQ_LOOPS) {
+        seqStop(F("Loops nested too deeply!"));
+        return;
       }
-    } else {
-      // Send GTL to addressed device
-      if (gpibBus.sendGTL()) {
-        if (isVerb) dataPort.println(F("Failed to send LOC!"));
+      seqLcnt[seqSp] = seqWord(seqPc+1);
+      seqPc += 3;
+      seqLpc[seqSp] = seqPc;
+      seqSp++;
+      break;
+
+    case SQ_NEXT:
+      if (seqSp == 0) {
+        seqStop(F("next without loop!"));
+        return;
       }
-      // Set GPIB controls back to idle state
+      if (seqLcnt[seqSp-1] == 1) {
+        // Last pass - leave the loop
+        seqSp--;
+        seqPc++;
+      }else{
+        // Count of 0 repeats until the sequence is stopped
+        if (seqLcnt[seqSp-1] > 1) seqLcnt[seqSp-1]--;
+        seqPc = seqLpc[seqSp-1];
+      }
+      break;
+
+    case SQ_TRG:
+      gpibBus.sendGET(gpibBus.cfg.paddr);
       gpibBus.setControls(CIDS);
-    }
+      seqPc++;
+      break;
+
+    case SQ_ADDR:
+      gpibBus.cfg.paddr = seqProg[seqPc+1];
+      seqPc += 2;
+      break;
+
+    case SQ_SPOLL:
+      dataPort.print(seqProg[seqPc+1]);
+      dataPort.print(':');
+      itoa(gpibBus.cfg.paddr, addr, 10);
+      spoll_h(addr);
+      seqPc += 2;
+      break;
+
+    default:
+      seqStop(F("Sequence completed."));
   }
 }
 
 
-/***** Assert IFC for 150 microseconds *****/
-/* This indicates that the AR488 the Controller-in-Charge on
- * the bus and causes all interfaces to return to their idle 
- * state
- */
-void ifc_h() {
-  if (gpibBus.cfg.cmode==2) {
-    // Assert IFC
-    gpibBus.setControlVal(0b00000000, 0b00000001, 0);
-    delayMicroseconds(150);
-    // De-assert IFC
-    gpibBus.setControlVal(0b00000001, 0b00000001, 0);
-    if (isVerb) dataPort.println(F("IFC signal asserted for 150 microseconds"));
-  }
+/***** Start the sequence from the beginning *****/
+void seqStart() {
+  seqPc = 0;
+  seqSp = 0;
+  seqWait = false;
+  seqRun = true;
 }
 
 
-/***** Send a trigger command *****/
-void trg_h(char *params) {
+/***** Add a step to the end of the sequence *****/
+void seqAdd(char *params) {
+  char *token = strtok(params, " \t");
   char *param;
-  uint8_t addrs[15] = {0};
+  seqRec * step = NULL;
   uint16_t val = 0;
-  uint8_t cnt = 0;
+  uint16_t len = 0;
 
-  addrs[0] = addrs[0]; // Meaningless as both are zero but defaults compiler warning!
-
-  // Read parameters
-  if (params == NULL) {
-    // No parameters - trigger addressed device only
-    addrs[0] = gpibBus.cfg.paddr;
-    cnt++;
-  } else {
-    // Read address parameters into array
-    while (cnt < 15) {
-      if (cnt == 0) {
-        param = strtok(params, " \t");
-      } else {
-        param = strtok(NULL, " \t");
-      }
-      if (param == NULL) {
-        break;  // Stop when there are no more parameters
-      }else{    
-        if (notInRange(param, 1, 30, val)) return;
-        addrs[cnt] = (uint8_t)val;
-        cnt++;
-      }
+  if (token != NULL) {
+    for (uint8_t i = 0; i < (sizeof(seqIdx) / sizeof(seqIdx[0])); i++) {
+      if (strcasecmp(seqIdx[i].token, token) == 0) step = &seqIdx[i];
     }
   }
+  if (step == NULL) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("Invalid step"));
+    return;
+  }
 
-  // If we have some addresses to trigger....
-  if (cnt > 0) {
-    for (int i = 0; i < cnt; i++) {
-      // Sent GET to the requested device
-      if (gpibBus.sendGET(addrs[i]))  {
-        if (isVerb) dataPort.println(F("Failed to trigger device!"));
-        return;
-      }
+  if (step->argtype == 3) {
+    // Remainder of the line is sent to the instrument
+    param = token + strlen(token) + 1;
+    len = strlen(param);
+    if ( (len == 0) || (len > 255) ) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
+    }
+  }else if (step->argtype > 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
     }
+    if (notInRange(param, step->minval, step->maxval, val)) return;
+  }
 
-    // Set GPIB controls back to idle state
-    gpibBus.setControls(CIDS);
+  // Leave room for the terminating SQ_END
+  len = (step->argtype == 3) ? (len + 1) : step->argtype;
+  if ( (seqLen + len + 1) >= SEQ_SIZE ) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("Sequence is full!"));
+    return;
+  }
 
-    if (isVerb) dataPort.println(F("Group trigger completed."));
+  seqProg[seqLen++] = step->op;
+  if (step->argtype == 3) {
+    seqProg[seqLen++] = len - 1;
+    memcpy(&seqProg[seqLen], param, len - 1);
+    seqLen += len - 1;
+  }else if (step->argtype > 0) {
+    seqProg[seqLen++] = val & 0xFF;
+    if (step->argtype == 2) seqProg[seqLen++] = val >> 8;
   }
+  seqProg[seqLen] = SQ_END;
 }
 
 
-/***** Reset the controller *****/
+/***** List the steps of the sequence *****/
+void seqList() {
+  uint16_t pc = 0;
+  seqRec * step;
+
+  while (pc < seqLen) {
+    step = &seqIdx[seqFind(seqProg[pc])];
+    dataPort.print(step->token);
+    switch (step->argtype) {
+      case 1:
+        dataPort.print(' ');
+        dataPort.print(seqProg[pc+1]);
+        break;
+      case 2:
+        dataPort.print(' ');
+        dataPort.print(seqWord(pc+1));
+        break;
+      case 3:
+        dataPort.print(' ');
+        dataPort.write(&seqProg[pc+2], seqProg[pc+1]);
+        break;
+    }
+    dataPort.println();
+    pc += seqStepSize(pc);
+  }
+}
+
+#endif
+
+
+/***** Timed acquisition *****/
 /*
- * Arduinos can use the watchdog timer to reset the MCU
- * For other devices, we restart the program instead by
- * jumping to address 0x0000. This is not a hardware reset
- * and will not reset a crashed MCU, but it will re-start
- * the interface program and re-initialise all parameters. 
+ * The timer tick counts down each entry and flags it as due when its
+ * period expires. Due entries are then serviced back-to-back from the
+ * main loop. Because the countdown is reloaded in the tick, a slow read
+ * delays only the reading, not the schedule.
  */
-void rst_h() {
-#ifdef WDTO_1S
-  // Where defined, reset controller using watchdog timeout
-  unsigned long tout;
-  tout = millis() + 2000;
-  wdt_enable(WDTO_1S);
-  while (millis() < tout) {};
-  // Should never reach here....
-  if (isVerb) {
-    dataPort.println(F("Reset FAILED."));
-  };
-#else
-  // Otherwise restart program (soft reset)
-  asm volatile ("  jmp 0");
-#endif
-}
+#ifdef USE_POLLER
 
+#define POLL_TICK_MS 10     // Timer tick period (milliseconds)
 
-/***** Serial Poll Handler *****/
-void spoll_h(char *params) {
-  char *param;
-  uint8_t addrs[15];
-  uint8_t sb = 0;
-  uint8_t r;
-  //  uint8_t i = 0;
-  uint8_t j = 0;
-  uint16_t addrval = 0;
-  bool all = false;
-  bool eoiDetected = false;
+struct pollRec {
+  uint8_t addr;             // Instrument address (0 = entry not used)
+  uint32_t ticks;           // Period in ticks
+  uint32_t remain;          // Ticks remaining until due
+  char query[POLL_QLEN];    // Query to send
+};
 
-  // Initialise address array
-  for (int i = 0; i < 15; i++) {
-    addrs[i] = 0;
-  }
+pollRec pollTab[POLL_ENTRIES];
+volatile uint8_t pollDue = 0;       // Bitmap of entries due to be read
+static_assert(POLL_ENTRIES <= 8, "POLL_ENTRIES must be 8 or less (pollDue is an 8 bit map)");
+#ifndef TIMSK1
+unsigned long pollLastTick = 0;     // Tick emulated with millis()
+#endif
 
-  // Read parameters
-  if (params == NULL) {
-    // No parameters - trigger addressed device only
-    addrs[0] = gpibBus.cfg.paddr;
-    j = 1;
-  } else {
-    // Read address parameters into array
-    while (j < 15) {
-      if (j == 0) {
-        param = strtok(params, " \t");
-      } else {
-        param = strtok(NULL, " \t");
-      }
-      // No further parameters so exit 
-      if (!param) break;
-      
-      // The 'all' parameter given?
-      if (strncmp(param, "all", 3) == 0) {
-        all = true;
-        j = 30;
-        if (isVerb) dataPort.println(F("Serial poll of all devices requested..."));
-        break;
-      // Valid GPIB address parameter ?
-      } else if (strlen(param) < 3) { // No more than 2 characters
-        if (notInRange(param, 1, 30, addrval)) return;
-        addrs[j] = (uint8_t)addrval;
-        j++;
-      // Other condition
-      } else {
-        errBadCmd();
-        if (isVerb) dataPort.println(F("Invalid parameter"));
-        return;
-      }
 
+/***** Timer tick - flag entries that are due *****/
+void pollTick() {
+  for (uint8_t i = 0; i < POLL_ENTRIES; i++) {
+    if (pollTab[i].addr == 0) continue;
+    pollTab[i].remain--;
+    if (pollTab[i].remain == 0) {
+      pollTab[i].remain = pollTab[i].ticks;
+      pollDue |= (1 << i);
     }
   }
+}
 
-  // Send Unlisten [UNL] to all devices
-  if ( gpibBus.sendCmd(GC_UNL) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNL"),"");
-#endif
-    return;
-  }
 
-  // Controller addresses itself as listner
-  if ( gpibBus.sendCmd(GC_LAD + gpibBus.cfg.caddr) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send LAD"),"");
+#ifdef TIMSK1
+/***** Timer1 compare match interrupt *****/
+ISR(TIMER1_COMPA_vect) {
+  pollTick();
+}
 #endif
-    return;
+
+
+/***** Start the timer tick *****/
+void pollStart() {
+  noInterrupts();
+  for (uint8_t i = 0; i < POLL_ENTRIES; i++) {
+    pollTab[i].remain = pollTab[i].ticks;
   }
+  pollDue = 0;
+#ifdef TIMSK1
+  // Timer1 in CTC mode with prescaler of 64
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+  OCR1A = (F_CPU / 64 / 1000 * POLL_TICK_MS) - 1;
+  TCNT1 = 0;
+  TIMSK1 |= _BV(OCIE1A);
+#else
+  pollLastTick = millis();
+#endif
+  interrupts();
+  pollRun = true;
+}
 
-  // Send Serial Poll Enable [SPE] to all devices
-  if ( gpibBus.sendCmd(GC_SPE) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send SPE"),"");
+
+/***** Stop the timer tick *****/
+void pollStop() {
+#ifdef TIMSK1
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
 #endif
-    return;
+  pollRun = false;
+  pollDue = 0;
+}
+
+
+/***** Read each entry that is due *****/
+/*
+ * Output record format: addr,timestamp:reading
+ * The timestamp is the value of millis() when the query was sent
+ */
+void pollService() {
+  uint8_t paddr = gpibBus.cfg.paddr;
+  uint8_t due;
+
+#ifndef TIMSK1
+  while ((millis() - pollLastTick) >= POLL_TICK_MS) {
+    pollLastTick += POLL_TICK_MS;
+    pollTick();
   }
+#endif
 
-  // Poll GPIB address or addresses as set by i and j
-  for (int i = 0; i < j; i++) {
+  for (uint8_t i = 0; i < POLL_ENTRIES; i++) {
+    noInterrupts();
+    due = pollDue & (1 << i);
+    pollDue &= ~(1 << i);
+    interrupts();
+    if (!due) continue;
+
+    if (!isBinRec) {
+      dataPort.print(pollTab[i].addr);
+      dataPort.print(',');
+      dataPort.print(millis());
+      dataPort.print(':');
+    }
 
-    // Set GPIB address in val
-    if (all) {
-      addrval = i;
-    } else {
-      addrval = addrs[i];
-    }
-
-    // Don't need to poll own address
-    if (addrval != gpibBus.cfg.caddr) {
+    gpibBus.addressDevice(pollTab[i].addr, LISTEN);
+    gpibBus.sendData(pollTab[i].query, strlen(pollTab[i].query));
+    gpibBus.unAddressDevice();
+    gpibBus.cfg.paddr = pollTab[i].addr;
+    if (readFromInstrument(gpibBus.cfg.eoi, false, 0) && !isBinRec) dataPort.println();
+  }
 
-      // Address a device to talk
-      if ( gpibBus.sendCmd(GC_TAD + addrval) )  {
+  gpibBus.cfg.paddr = paddr;
+}
 
-#ifdef DEBUG_SPOLL
-        DB_PRINT(F("failed to send TAD"),"");
 #endif
-        return;
-      }
 
-      // Set GPIB control to controller active listner state (ATN unasserted)
-      gpibBus.setControls(CLAS);
 
-      // Read the response byte (usually device status) using handshake - suppress EOI detection
-      r = gpibBus.readByte(&sb, false, &eoiDetected);
+/***** Instrument probing *****/
+/*
+ * A query is sent to the instrument and the reply is read with EOI
+ * detection and the read_tmo_ms timeout. The reply shows whether the
+ * instrument asserts EOI and which terminator it uses, and the read
+ * gives the time to the first byte and the longest gap between bytes.
+ * From these a profile is kept for the address that allows reads to
+ * end as soon as possible. The time to the first byte depends on the
+ * query, so the profile keeps only the terminator and the inter-byte
+ * timeout and the first byte timeout set by ++tmo_us still applies.
+ */
+#ifdef USE_PROBE
 
-      // If we successfully read a byte
-      if (!r) {
-        if (j == 30) {
-          // If all, return specially formatted response: SRQ:addr,status
-          // but only when RQS bit set
-          if (sb & 0x40) {
-            dataPort.print(F("SRQ:")); dataPort.print(i); dataPort.print(F(",")); dataPort.println(sb, DEC);
-            // Exit on first device to respond
-            i = j;
-          }
-        } else {
-          // Return decimal number representing status byte
-          dataPort.println(sb, DEC);
-          if (isVerb) {
-            dataPort.print(F("Received status byte ["));
-            dataPort.print(sb);
-            dataPort.print(F("] from device at address: "));
-            dataPort.println(addrval);
-          }
-          // Exit on first device to respond
-          i = j;
-        }
-      } else {
-        if (isVerb) dataPort.println(F("Failed to retrieve status byte"));
-      }
-    }
-  }
-  if (all) dataPort.println();
+#define PROBE_MARGIN_US 1000      // Added to measured times (microseconds)
+#define PROBE_MAX_US 32000000     // Longest timeout (microseconds)
 
-  // Send Serial Poll Disable [SPD] to all devices
-  if ( gpibBus.sendCmd(GC_SPD) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send SPD"),"");
-#endif
-    return;
-  }
+struct probeRec {
+  uint8_t addr;             // Instrument address (0 = entry not used)
+  uint8_t eor;              // Terminator (as ++eor)
+  uint32_t tmoNext;         // Inter-byte timeout (microseconds)
+};
 
-  // Send Untalk [UNT] to all devices
-  if ( gpibBus.sendCmd(GC_UNT) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNT"),"");
-#endif
-    return;
-  }
+probeRec probeTab[PROBE_ENTRIES];
+TAILSTREAM tailStream;
 
-  // Unadress listners [UNL] to all devices
-  if ( gpibBus.sendCmd(GC_UNL) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNL"),"");
-#endif
-    return;
+
+/***** Find the profile for an address *****/
+uint8_t probeFind(uint8_t addr) {
+  for (uint8_t i = 0; i < PROBE_ENTRIES; i++) {
+    if (probeTab[i].addr == addr) return i;
   }
+  return 0xFF;
+}
 
-  // Set GPIB control to controller idle state
-  gpibBus.setControls(CIDS);
 
-  // Set SRQ to status of SRQ line. Should now be unasserted but, if it is
-  // still asserted, then another device may be requesting service so another
-  // serial poll will be called from the main loop
-/*  FLAG NO LONGER USED = NOW CHECKING STATUS OF LINE
-  if (digitalRead(SRQ) == LOW) {
-    isSRQ = true;
-  } else {
-    isSRQ = false;
-  }
-*/
-  if (isVerb) dataPort.println(F("Serial poll completed."));
+/***** Use the profile for an address if there is one *****/
+bool probeApply(uint8_t addr) {
+  uint8_t i = probeFind(addr);
+  if ( (addr == 0) || (i == 0xFF) ) return false;
+  gpibBus.cfg.eor = probeTab[i].eor;
+  gpibBus.tmoNext = probeTab[i].tmoNext;
+  return true;
+}
 
+
+/***** Show a profile *****/
+void probeShow(uint8_t i) {
+  dataPort.print(probeTab[i].addr);
+  dataPort.print(F(": eor "));
+  dataPort.print(probeTab[i].eor);
+  dataPort.print(F(", next "));
+  dataPort.print(probeTab[i].tmoNext);
+  dataPort.println(F("us"));
 }
 
 
-/***** Return status of SRQ line *****/
-void srq_h() {
-  //NOTE: LOW=0=asserted, HIGH=1=unasserted
-//  dataPort.println(!digitalRead(SRQ));
-  dataPort.println(gpibBus.isAsserted(SRQ));
+/***** Work out the terminator from the last bytes received *****/
+uint8_t probeTerminator() {
+  uint8_t *tail = tailStream.tail;
+  if (gpibBus.rxFlags & RX_EOI) return 7;
+  if ( (tailStream.count > 2) && (tail[0] == 0x03) && (tail[1] == LF) && (tail[2] == CR) ) return 6;
+  if ( (tailStream.count > 1) && (tail[0] == LF) && (tail[1] == CR) ) return 0;
+  if ( (tailStream.count > 1) && (tail[0] == CR) && (tail[1] == LF) ) return 4;
+  if (tail[0] == LF) return 2;
+  if (tail[0] == CR) return 1;
+  if (tail[0] == 0x03) return 5;
+  return 3;
 }
 
 
-/***** Set the status byte (device mode) *****/
-void stat_h(char *params) {
-  uint16_t statusByte = 0;
-  // A parameter given?
-  if (params != NULL) {
-    // Byte value given?
-    if (notInRange(params, 0, 255, statusByte)) return;
-    gpibBus.setStatus((uint8_t)statusByte);
-  } else {
-    // Return the currently set status byte
-    dataPort.println(gpibBus.cfg.stat);
+/***** Probe an instrument and keep its profile *****/
+void probeRun(uint8_t addr, char *query) {
+  uint8_t paddr = gpibBus.cfg.paddr;
+  uint8_t eor = gpibBus.cfg.eor;
+  uint32_t tmoFirst = gpibBus.tmoFirst;
+  uint32_t tmoNext = gpibBus.tmoNext;
+  uint32_t tmoTotal = gpibBus.tmoTotal;
+  uint32_t tmo;
+  uint8_t i;
+
+  // Send the query and read the reply until EOI or timeout
+  gpibBus.cfg.paddr = addr;
+  gpibBus.cfg.eor = 3;
+  gpibBus.tmoFirst = 0;
+  gpibBus.tmoNext = 0;
+  gpibBus.tmoTotal = 0;
+  gpibBus.addressDevice(addr, LISTEN);
+  gpibBus.sendData(query, strlen(query));
+  gpibBus.unAddressDevice();
+  tailStream.begin();
+  gpibBus.receiveData(tailStream, true, false, 0);
+  gpibBus.cfg.paddr = paddr;
+  gpibBus.cfg.eor = eor;
+  gpibBus.tmoFirst = tmoFirst;
+  gpibBus.tmoNext = tmoNext;
+  gpibBus.tmoTotal = tmoTotal;
+
+  if ( (tailStream.count == 0) || (gpibBus.rxFlags & RX_ABORT) ) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("No reply from instrument"));
+    return;
+  }
+
+  // Find the profile for the address or a free entry
+  i = probeFind(addr);
+  if (i == 0xFF) i = probeFind(0);
+  if (i == 0xFF) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("No free profile entry!"));
+    return;
   }
-}
 
+  probeTab[i].addr = addr;
+  probeTab[i].eor = probeTerminator();
+  tmo = gpibBus.rxGapUs * 4 + PROBE_MARGIN_US;
+  probeTab[i].tmoNext = (tmo > PROBE_MAX_US) ? PROBE_MAX_US : tmo;
 
-/***** Save controller configuration *****/
-void save_h() {
-#ifdef E2END
-  epWriteData(gpibBus.cfg.db, GPIB_CFG_SIZE);
-  if (isVerb) dataPort.println(F("Settings saved."));
-#else
-  dataPort.println(F("EEPROM not supported."));
-#endif
+  if (isVerb) {
+    dataPort.print(tailStream.count);
+    dataPort.print(F(" bytes received, first after "));
+    dataPort.print(gpibBus.rxFirstUs);
+    dataPort.println(F("us"));
+  }
+  probeShow(i);
 }
 
+#endif
+
 
-/***** Show state or enable/disable listen only mode *****/
-void lon_h(char *params) {
-  uint16_t lval;
+/*************************************/
+/***** STANDARD COMMAND HANDLERS *****/
+/*************************************/
+
+/***** Show or change device address *****/
+void addr_h(char *params) {
+  //  char *param, *stat;
+//  char *param;
+  uint16_t val;
   if (params != NULL) {
-    if (notInRange(params, 0, 1, lval)) return;
-    isRO = lval ? true : false;
-    if (isRO) {
-      isTO = 0;       // Talk-only mode must be disabled!
-      isProm = false; // Promiscuous mode must be disabled!
+
+    // Primary address
+//    param = strtok(params, " \t");
+//    if (notInRange(param, 1, 30, val)) return;
+    if (notInRange(params, 1, 30, val)) return;
+    if (val == gpibBus.cfg.caddr) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("That is my address! Address of a remote device is required."));
+      return;
     }
+    gpibBus.cfg.paddr = val;
     if (isVerb) {
-      dataPort.print(F("LON: "));
-      dataPort.println(lval ? "ON" : "OFF") ;
+      dataPort.print(F("Set device primary address to: "));
+      dataPort.println(val);
     }
   } else {
-    dataPort.println(isRO);
+    dataPort.println(gpibBus.cfg.paddr);
   }
 }
 
 
-/***** Show help message *****/
-void help_h(char *params) {
-  char c, t;
-  char token[20];
-  uint8_t i;
-
-  i = 0;
-  for (size_t k = 0; k < strlen_P(cmdHelp); k++) {
-    c = pgm_read_byte_near(cmdHelp + k);
-
-
-    if (i < 20) {
-      if(c == ':') {
-        token[i] = 0;
-        if((params == NULL) || (strcmp(token, params) == 0)) {
-          dataPort.print(F("++"));
-          dataPort.print(token);
-          dataPort.print(c);
-          k++;
-          t = pgm_read_byte_near(cmdHelp + k);
-          dataPort.print(F(" ["));
-          dataPort.print(t);
-          dataPort.print(F("]"));
-          i = 255; // means we need to print until \n
-        }
-        
-      } else {
-        token[i] = c;
-        i++;
-      }
-    } else if (i == 255) {
-      dataPort.print(c);
-    }
-    if (c == '\n') {
-      i = 0;
+/***** Show or set read timout *****/
+void rtmo_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 1, 32000, val)) return;
+    gpibBus.cfg.rtmo = val;
+    if (isVerb) {
+      dataPort.print(F("Set [read_tmo_ms] to: "));
+      dataPort.print(val);
+      dataPort.println(F(" milliseconds"));
     }
+  } else {
+    dataPort.println(gpibBus.cfg.rtmo);
   }
 }
 
 
+/***** Show or set read timeouts in microseconds *****/
+/*
+ * ++tmo_us first [next [total]]
+ * first: time to wait for the first byte (0 = use read_tmo_ms)
+ * next:  time to wait for each following byte (0 = use read_tmo_ms)
+ * total: time limit for the whole transfer (0 = no limit)
+ */
+void tmous_h(char *params) {
+  char *param;
+  char *endp;
+  uint32_t val[3];
+  uint8_t cnt = 0;
 
+  if (params == NULL) {
+    dataPort.print(gpibBus.tmoFirst);
+    dataPort.print(' ');
+    dataPort.print(gpibBus.tmoNext);
+    dataPort.print(' ');
+    dataPort.println(gpibBus.tmoTotal);
+    return;
+  }
 
+  val[0] = gpibBus.tmoFirst;
+  val[1] = gpibBus.tmoNext;
+  val[2] = gpibBus.tmoTotal;
+  param = strtok(params, " \t");
+  while (param != NULL) {
+    if (cnt == 3) {
+      errBadCmd();
+      return;
+    }
+    val[cnt] = strtoul(param, &endp, 10);
+    if ( (*endp != '\0') || (val[cnt] > 32000000) ) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Valid range is between 0 and 32000000"));
+      return;
+    }
+    cnt++;
+    param = strtok(NULL, " \t");
+  }
 
-/***********************************/
-/***** CUSTOM COMMAND HANDLERS *****/
-/***********************************/
-
-/***** All serial poll *****/
-/*
- * Polls all devices, not just the currently addressed instrument
- * This is an alias wrapper for ++spoll all
- */
-void aspoll_h() {
-  //  char all[4];
-  //  strcpy(all, "all\0");
-  spoll_h((char*)"all");
+  gpibBus.tmoFirst = val[0];
+  gpibBus.tmoNext = val[1];
+  gpibBus.tmoTotal = val[2];
+  if (isVerb) {
+    dataPort.print(F("Set timeouts to: "));
+    dataPort.print(val[0]);
+    dataPort.print(' ');
+    dataPort.print(val[1]);
+    dataPort.print(' ');
+    dataPort.print(val[2]);
+    dataPort.println(F(" microseconds"));
+  }
 }
 
 
-/***** Send Universal Device Clear *****/
+/***** Show or set bus timing *****/
 /*
- * The universal Device Clear (DCL) is unaddressed and affects all devices on the Gpib bus.
+ * ++speed                 - show the EOI pulse width and the data settling times (T1)
+ * ++speed std|long|short  - presets: interlocked defaults, long cables, short cables
+ * ++speed t1 ns [addr...] - data settling time for the addresses given or all addresses
+ * ++speed eoi us          - EOI pulse width (1-255 microseconds)
  */
-void dcl_h() {
-  if ( gpibBus.sendCmd(GC_DCL) )  {
-    if (isVerb) dataPort.println(F("Sending DCL failed"));
+void speed_h(char *params) {
+  char *param;
+  char *endp;
+  uint32_t val;
+  uint16_t ns;
+  uint8_t i;
+
+  if (params == NULL) {
+    if (isVerb) dataPort.println(F("eoi us, then addr t1 ns for each address with a settling time"));
+    dataPort.println(gpibBus.eoiUs);
+    for (i = 0; i < T1_ADDRS; i++) {
+      if (gpibBus.getT1(i)) {
+        dataPort.print(i);
+        dataPort.print(' ');
+        dataPort.println(gpibBus.getT1(i));
+      }
+    }
     return;
   }
-  // Set GPIB controls back to idle state
-  gpibBus.setControls(CIDS);
-}
 
+  param = strtok(params, " \t");
+
+  // Presets
+  if (strncasecmp(param, "std", 3) == 0) {
+    // No added settling time, as before bus timing could be set
+    gpibBus.setT1(0xFF, 0);
+    gpibBus.eoiUs = EOI_US;
+  } else if (strncasecmp(param, "long", 4) == 0) {
+    // IEEE 488.1 T1 for open collector drivers and full length cables
+    gpibBus.setT1(0xFF, 2000);
+    gpibBus.eoiUs = EOI_US;
+  } else if (strncasecmp(param, "short", 5) == 0) {
+    // Short cables and fast listeners
+    gpibBus.setT1(0xFF, 0);
+    gpibBus.eoiUs = 2;
+
+  // Data settling time
+  } else if (strncasecmp(param, "t1", 2) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      return;
+    }
+    val = strtoul(param, &endp, 10);
+    if ( (*endp != '\0') || (val > 65535) ) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Valid range is between 0 and 65535"));
+      return;
+    }
+    ns = (uint16_t)val;
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      gpibBus.setT1(0xFF, ns);
+    } else {
+      while (param != NULL) {
+        val = strtoul(param, &endp, 10);
+        if ( (*endp != '\0') || (val >= T1_ADDRS) ) {
+          errBadCmd();
+          return;
+        }
+        gpibBus.setT1((uint8_t)val, ns);
+        param = strtok(NULL, " \t");
+      }
+    }
+
+  // EOI pulse width
+  } else if (strncasecmp(param, "eoi", 3) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      return;
+    }
+    val = strtoul(param, &endp, 10);
+    if ( (*endp != '\0') || (val < 1) || (val > 255) ) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Valid range is between 1 and 255"));
+      return;
+    }
+    gpibBus.eoiUs = (uint8_t)val;
+
+  } else {
+    errBadCmd();
+    return;
+  }
+
+  if (isVerb) {
+    dataPort.print(F("EOI pulse: "));
+    dataPort.print(gpibBus.eoiUs);
+    dataPort.print(F("us, T1 for address "));
+    dataPort.print(gpibBus.cfg.paddr);
+    dataPort.print(F(": "));
+    dataPort.print(gpibBus.getT1(gpibBus.cfg.paddr));
+    dataPort.println(F("ns"));
+  }
+}
+
+
+/***** Show or clear the device mode output FIFO *****/
+/*
+ * Applies to the FIFO of the address selected with ++devaddr use.
+ * ++txfifo      - show bytes queued, bytes free and lines discarded
+ * ++txfifo clr  - discard all queued data
+ */
+void txfifo_h(char *params) {
+#ifdef USE_TXFIFO
+  if (params != NULL) {
+    if (strncasecmp(params, "clr", 3) == 0) {
+      txClear(devSel);
+    } else {
+      errBadCmd();
+    }
+    return;
+  }
+  if (isVerb) dataPort.println(F("queued free lost"));
+  dataPort.print(TXFIFO_MASK - txFree(devSel));
+  dataPort.print(' ');
+  dataPort.print(txFree(devSel));
+  dataPort.print(' ');
+  dataPort.println(txLost[devSel]);
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+/***** Show or set the addresses answered to in device mode *****/
+/*
+ * ++devaddr           - show the addresses, then the selected address
+ * ++devaddr add addr  - answer to another address
+ * ++devaddr del addr  - stop answering to an address added with add
+ * ++devaddr use addr  - send host data, ++status and ++txfifo to this address
+ * ++devaddr clr       - remove all addresses added with add
+ */
+void devaddr_h(char *params) {
+#if defined(USE_TXFIFO) && (DEV_ADDRS > 1)
+  char *keyword;
+  char *param;
+  uint16_t val = 0;
+  uint8_t slot;
+  uint8_t i;
+
+  if (params == NULL) {
+    if (isVerb) dataPort.println(F("addresses, then selected address"));
+    dataPort.print(gpibBus.cfg.paddr);
+    for (i = 1; i < DEV_ADDRS; i++) {
+      if (devAddr[i]) {
+        dataPort.print(' ');
+        dataPort.print(devAddr[i]);
+      }
+    }
+    dataPort.println();
+    dataPort.println(devSel ? devAddr[devSel] : gpibBus.cfg.paddr);
+    return;
+  }
+
+  keyword = strtok(params, " \t");
+
+  if (strncasecmp(keyword, "clr", 3) == 0) {
+    for (i = 1; i < DEV_ADDRS; i++) {
+      devAddr[i] = 0;
+      devStat[i] = 0;
+      txClear(i);
+    }
+    devSel = 0;
+    devTalk = 0;
+    devListen = 0;
+    devUpdateSrq();
+    return;
+  }
+
+  param = strtok(NULL, " \t");
+  if ( (param == NULL) || notInRange(param, 1, 30, val) ) {
+    if (param == NULL) errBadCmd();
+    return;
+  }
+  slot = devFind(val);
+
+  if (strncasecmp(keyword, "add", 3) == 0) {
+    if (slot != NO_SLOT) return;  // Already one of ours
+    for (i = 1; i < DEV_ADDRS; i++) {
+      if (devAddr[i] == 0) break;
+    }
+    if (i == DEV_ADDRS) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Address table full"));
+      return;
+    }
+    devAddr[i] = val;
+    devStat[i] = 0;
+    txClear(i);
+
+  } else if (strncasecmp(keyword, "del", 3) == 0) {
+    if ( (slot == NO_SLOT) || (slot == 0) ) {
+      errBadCmd();
+      return;
+    }
+    devAddr[slot] = 0;
+    devStat[slot] = 0;
+    txClear(slot);
+    if (devSel == slot) devSel = 0;
+    if (devTalk == slot) devTalk = 0;
+    if (devListen == slot) devListen = 0;
+    devUpdateSrq();
+
+  } else if (strncasecmp(keyword, "use", 3) == 0) {
+    if (slot == NO_SLOT) {
+      errBadCmd();
+      return;
+    }
+    devSel = slot;
+    txResume();
+
+  } else {
+    errBadCmd();
+  }
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+/***** Show or set the replies sent in device mode without the host *****/
+/*
+ * ++resp                     - list the entries (n: query|response)
+ * ++resp add query|response  - answer query with response (replaces an entry for the same query)
+ * ++resp del n               - delete entry n
+ * ++resp clr                 - delete all entries
+ */
+void resp_h(char *params) {
+#ifdef USE_RESPONDER
+  char *keyword = NULL;
+  char *param;
+  char *sep;
+  uint16_t val;
+  uint8_t plen = 0;
+  uint8_t i;
+
+  if (params != NULL) {
+    plen = strlen(params);
+    keyword = strtok(params, " \t");
+  }
+
+  if ( (keyword == NULL) || (strncasecmp(keyword, "list", 4) == 0) ) {
+    for (i = 0; i < RESP_ENTRIES; i++) {
+      if (respQry[i][0] == '\0') continue;
+      dataPort.print(i);
+      dataPort.print(F(": "));
+      dataPort.print(respQry[i]);
+      dataPort.print('|');
+      dataPort.println(respTxt[i]);
+    }
+    return;
+  }
+
+  if (strncasecmp(keyword, "clr", 3) == 0) {
+    memset(respQry, 0, sizeof(respQry));
+    memset(respPending, 0, sizeof(respPending));
+    return;
+  }
+
+  if (strncasecmp(keyword, "del", 3) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
+    }
+    if (notInRange(param, 0, RESP_ENTRIES-1, val)) return;
+    respQry[val][0] = '\0';
+    memset(respPending, 0, sizeof(respPending));
+    return;
+  }
+
+  if (strncasecmp(keyword, "add", 3) == 0) {
+    // Query|response - remainder of the line
+    param = keyword + strlen(keyword);
+    if ((uint8_t)(param - params) < plen) param++;
+    while ( (*param == ' ') || (*param == '\t') ) param++;
+    sep = strchr(param, '|');
+    if ( (sep == NULL) || (sep == param) || ((sep - param) > RESP_QLEN) || (strlen(sep + 1) > RESP_RLEN) ) {
+      errBadCmd();
+      if (isVerb) {
+        dataPort.print(F("Query of 1 - "));
+        dataPort.print(RESP_QLEN);
+        dataPort.print(F(" and response of up to "));
+        dataPort.print(RESP_RLEN);
+        dataPort.println(F(" characters required"));
+      }
+      return;
+    }
+    *sep = '\0';
+    // Replace the entry for the same query, else use a free entry
+    i = respFind(param);
+    if (i == RESP_ENTRIES) {
+      for (i = 0; i < RESP_ENTRIES; i++) {
+        if (respQry[i][0] == '\0') break;
+      }
+    }
+    if (i == RESP_ENTRIES) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("No free response entry!"));
+      return;
+    }
+    strcpy(respQry[i], param);
+    strcpy(respTxt[i], sep + 1);
+    if (isVerb) {
+      dataPort.print(F("Added entry "));
+      dataPort.println(i);
+    }
+    return;
+  }
+
+  errBadCmd();
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+/***** Enable or disable the HS488 handshake *****/
+/*
+ * ++hs488               - show state, DAV pulse width, HS488 bytes and fallbacks
+ * ++hs488 0|1 [pulse]   - disable/enable, optionally with the DAV pulse width (1-255us)
+ * ++hs488 talk          - show the talkers read with HS488
+ * ++hs488 talk addr...  - read these talkers with HS488 ("all" for any talker)
+ * ++hs488 talk clr      - read all talkers with the interlocked handshake
+ */
+void hs488_h(char *params) {
+#ifdef USE_HS488
+  char *param;
+  uint16_t val;
+
+  if (params == NULL) {
+    if (isVerb) dataPort.println(F("hs488: enabled, pulse us, bytes, fallbacks"));
+    dataPort.print(gpibBus.hs488 ? 1 : 0);
+    dataPort.print(' ');
+    dataPort.print(gpibBus.hsPulse);
+    dataPort.print(' ');
+    dataPort.print(gpibBus.hsBytes);
+    dataPort.print(' ');
+    dataPort.println(gpibBus.hsFallback);
+    return;
+  }
+
+  param = strtok(params, " \t");
+
+  if (strncasecmp(param, "talk", 4) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      if (gpibBus.hsTalkers & (1UL << HS_ANY_TALKER)) {
+        dataPort.println(F("all"));
+        return;
+      }
+      for (val = 0; val < HS_ANY_TALKER; val++) {
+        if (gpibBus.hsTalkers & (1UL << val)) {
+          dataPort.print(val);
+          dataPort.print(' ');
+        }
+      }
+      dataPort.println();
+      return;
+    }
+    if (strncasecmp(param, "clr", 3) == 0) {
+      gpibBus.hsTalkers = 0;
+      return;
+    }
+    while (param != NULL) {
+      if (strncasecmp(param, "all", 3) == 0) {
+        gpibBus.hsTalkers |= (1UL << HS_ANY_TALKER);
+      } else {
+        if (notInRange(param, 0, 30, val)) return;
+        gpibBus.hsTalkers |= (1UL << val);
+      }
+      param = strtok(NULL, " \t");
+    }
+    return;
+  }
+
+  if (notInRange(param, 0, 1, val)) return;
+  gpibBus.hs488 = val ? true : false;
+  param = strtok(NULL, " \t");
+  if (param != NULL) {
+    if (notInRange(param, 1, 255, val)) return;
+    gpibBus.hsPulse = (uint8_t)val;
+  }
+  if (isVerb) {
+    dataPort.print(F("HS488 handshake "));
+    dataPort.print(gpibBus.hs488 ? F("enabled") : F("disabled"));
+    dataPort.print(F(", DAV pulse "));
+    dataPort.print(gpibBus.hsPulse);
+    dataPort.println(F("us"));
+  }
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+
+/***** Show or set end of send character *****/
+void eos_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 3, val)) return;
+    gpibBus.cfg.eos = (uint8_t)val;
+    if (isVerb) {
+      dataPort.print(F("Set EOS to: "));
+      dataPort.println(val);
+    };
+  } else {
+    dataPort.println(gpibBus.cfg.eos);
+  }
+}
+
+
+/***** Show or set EOI assertion on/off *****/
+void eoi_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, val)) return;
+    gpibBus.cfg.eoi = val ? true : false;
+    if (isVerb) {
+      dataPort.print(F("Set EOI assertion: "));
+      dataPort.println(val ? "ON" : "OFF");
+    };
+  } else {
+    dataPort.println(gpibBus.cfg.eoi);
+  }
+}
+
+
+/***** Show or set interface to controller/device mode *****/
+void cmode_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, val)) return;
+    switch (val) {
+      case 0:
+        gpibBus.startDeviceMode();
+        break;
+      case 1:
+        gpibBus.startControllerMode();
+        break;
+    }
+    if (isVerb) {
+      dataPort.print(F("Interface mode set to: "));
+      dataPort.println(val ? "CONTROLLER" : "DEVICE");
+    }
+  } else {
+    dataPort.println(gpibBus.isController());
+  }
+}
+
+
+/***** Show or enable/disable sending of end of transmission character *****/
+void eot_en_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, val)) return;
+    gpibBus.cfg.eot_en = val ? true : false;
+    if (isVerb) {
+      dataPort.print(F("Appending of EOT character: "));
+      dataPort.println(val ? "ON" : "OFF");
+    }
+  } else {
+    dataPort.println(gpibBus.cfg.eot_en);
+  }
+}
+
+
+/***** Show or set end of transmission character *****/
+void eot_char_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 255, val)) return;
+    gpibBus.cfg.eot_ch = (uint8_t)val;
+    if (isVerb) {
+      dataPort.print(F("EOT set to ASCII character: "));
+      dataPort.println(val);
+    };
+  } else {
+    dataPort.println(gpibBus.cfg.eot_ch, DEC);
+  }
+}
+
+
+/***** Show or enable/disable auto mode *****/
+void amode_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 3, val)) return;
+    if (val > 0 && isVerb) {
+      dataPort.println(F("WARNING: automode ON can cause some devices to generate"));
+      dataPort.println(F("         'addressed to talk but nothing to say' errors"));
+    }
+    gpibBus.cfg.amode = (uint8_t)val;
+    if (gpibBus.cfg.amode < 3) autoRead = false;
+    if (isVerb) {
+      dataPort.print(F("Auto mode: "));
+      dataPort.println(gpibBus.cfg.amode);
+    }
+  } else {
+    dataPort.println(gpibBus.cfg.amode);
+  }
+}
+
+
+/***** Display the controller version string *****/
+void ver_h(char *params) {
+  // If "real" requested
+  if (params != NULL && strncasecmp(params, "real", 3) == 0) {
+    dataPort.println(F(FWVER));
+    // Otherwise depends on whether we have a custom string set
+  } else {
+    if (strlen(gpibBus.cfg.vstr) > 0) {
+      dataPort.println(gpibBus.cfg.vstr);
+    } else {
+      dataPort.println(F(FWVER));
+    }
+  }
+}
+
+
+/***** Address device to talk and read the sent data *****/
+void read_h(char *params) {
+  // Clear read flags
+  readWithEoi = false;
+  readWithEndByte = false;
+  endByte = 0;
+  // Read any parameters
+  if (params != NULL) {
+    if (strlen(params) > 3) {
+      if (isVerb) dataPort.println(F("Invalid parameter - ignored!"));
+    } else if (strncasecmp(params, "eoi", 3) == 0) { // Read with eoi detection
+      readWithEoi = true;
+    } else { // Assume ASCII character given and convert to an 8 bit byte
+      readWithEndByte = true;
+      endByte = atoi(params);
+    }
+  }
+
+//DB_PRINT(F("readWithEoi:     "), readWithEoi);
+//DB_PRINT(F("readWithEndByte: "), readWithEndByte);
+
+  if (gpibBus.cfg.amode == 3) {
+    // In auto continuous mode we set this flag to indicate we are ready for continuous read
+    autoRead = true;
+  } else {
+    // If auto mode is disabled we do a single read
+    gpibBus.addressDevice(gpibBus.cfg.paddr, TALK);
+    readFromInstrument(readWithEoi, readWithEndByte, endByte);
+  }
+}
+
+
+/***** Send device clear (usually resets the device to power on state) *****/
+void clr_h() {
+  if (gpibBus.sendSDC())  {
+    if (isVerb) dataPort.println(F("Failed to send SDC"));
+    return;
+  }
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+}
+
+
+/***** Send local lockout command *****/
+void llo_h(char *params) {
+  // NOTE: REN *MUST* be asserted (LOW)
+  if (digitalRead(REN)==LOW) {
+    // For 'all' send LLO to the bus without addressing any device
+    // Devices will show REM as soon as they are addressed and need to be released with LOC
+    if (params != NULL) {
+      if (0 == strncmp(params, "all", 3)) {
+        if (gpibBus.sendCmd(GC_LLO)) {
+          if (isVerb) dataPort.println(F("Failed to send universal LLO."));
+        }
+      }
+    } else {
+      // Send LLO to currently addressed device
+      if (gpibBus.sendLLO()){
+        if (isVerb) dataPort.println(F("Failed to send LLO!"));
+      }
+    }
+  }
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+}
+
+
+/***** Send Go To Local (GTL) command *****/
+void loc_h(char *params) {
+  // REN *MUST* be asserted (LOW)
+  if (digitalRead(REN)==LOW) {
+    if (params != NULL) {
+      if (strncmp(params, "all", 3) == 0) {
+        // Send request to clear all devices to local
+        gpibBus.sendAllClear();
+      }
+    } else {
+      // Send GTL to addressed device
+      if (gpibBus.sendGTL()) {
+        if (isVerb) dataPort.println(F("Failed to send LOC!"));
+      }
+      // Set GPIB controls back to idle state
+      gpibBus.setControls(CIDS);
+    }
+  }
+}
+
+
+/***** Assert IFC for 150 microseconds *****/
+/* This indicates that the AR488 the Controller-in-Charge on
+ * the bus and causes all interfaces to return to their idle 
+ * state
+ */
+void ifc_h() {
+  if (gpibBus.cfg.cmode==2) {
+    // Assert IFC
+    gpibBus.setControlVal(0b00000000, 0b00000001, 0);
+    delayMicroseconds(150);
+    // De-assert IFC
+    gpibBus.setControlVal(0b00000001, 0b00000001, 0);
+    if (isVerb) dataPort.println(F("IFC signal asserted for 150 microseconds"));
+  }
+}
+
+
+/***** Send a trigger command *****/
+void trg_h(char *params) {
+  char *param;
+  uint8_t addrs[15] = {0};
+  uint16_t val = 0;
+  uint8_t cnt = 0;
+
+  addrs[0] = addrs[0]; // Meaningless as both are zero but defaults compiler warning!
+
+  // Read parameters
+  if (params == NULL) {
+    // No parameters - trigger addressed device only
+    addrs[0] = gpibBus.cfg.paddr;
+    cnt++;
+  } else {
+    // Read address parameters into array
+    while (cnt < 15) {
+      if (cnt == 0) {
+        param = strtok(params, " \t");
+      } else {
+        param = strtok(NULL, " \t");
+      }
+      if (param == NULL) {
+        break;  // Stop when there are no more parameters
+      }else{    
+        if (notInRange(param, 1, 30, val)) return;
+        addrs[cnt] = (uint8_t)val;
+        cnt++;
+      }
+    }
+  }
+
+  // If we have some addresses to trigger....
+  if (cnt > 0) {
+    for (int i = 0; i < cnt; i++) {
+      // Sent GET to the requested device
+      if (gpibBus.sendGET(addrs[i]))  {
+        if (isVerb) dataPort.println(F("Failed to trigger device!"));
+        return;
+      }
+    }
+
+    // Set GPIB controls back to idle state
+    gpibBus.setControls(CIDS);
+
+    if (isVerb) dataPort.println(F("Group trigger completed."));
+  }
+}
+
+
+/***** Reset the controller *****/
+/*
+ * Arduinos can use the watchdog timer to reset the MCU
+ * For other devices, we restart the program instead by
+ * jumping to address 0x0000. This is not a hardware reset
+ * and will not reset a crashed MCU, but it will re-start
+ * the interface program and re-initialise all parameters. 
+ */
+void rst_h() {
+#ifdef WDTO_1S
+  // Where defined, reset controller using watchdog timeout
+  unsigned long tout;
+  tout = millis() + 2000;
+  wdt_enable(WDTO_1S);
+  while (millis() < tout) {};
+  // Should never reach here....
+  if (isVerb) {
+    dataPort.println(F("Reset FAILED."));
+  };
+#else
+  // Otherwise restart program (soft reset)
+  asm volatile ("  jmp 0");
+#endif
+}
+
+
+/***** Serial Poll Handler *****/
+void spoll_h(char *params) {
+  char *param;
+  uint8_t addrs[15];
+  uint8_t sb = 0;
+  uint8_t r;
+  //  uint8_t i = 0;
+  uint8_t j = 0;
+  uint16_t addrval = 0;
+  bool all = false;
+  bool eoiDetected = false;
+
+  // Initialise address array
+  for (int i = 0; i < 15; i++) {
+    addrs[i] = 0;
+  }
+
+  // Read parameters
+  if (params == NULL) {
+    // No parameters - trigger addressed device only
+    addrs[0] = gpibBus.cfg.paddr;
+    j = 1;
+  } else {
+    // Read address parameters into array
+    while (j < 15) {
+      if (j == 0) {
+        param = strtok(params, " \t");
+      } else {
+        param = strtok(NULL, " \t");
+      }
+      // No further parameters so exit 
+      if (!param) break;
+      
+      // The 'all' parameter given?
+      if (strncmp(param, "all", 3) == 0) {
+        all = true;
+        j = 30;
+        if (isVerb) dataPort.println(F("Serial poll of all devices requested..."));
+        break;
+      // Valid GPIB address parameter ?
+      } else if (strlen(param) < 3) { // No more than 2 characters
+        if (notInRange(param, 1, 30, addrval)) return;
+        addrs[j] = (uint8_t)addrval;
+        j++;
+      // Other condition
+      } else {
+        errBadCmd();
+        if (isVerb) dataPort.println(F("Invalid parameter"));
+        return;
+      }
+
+    }
+  }
+
+  // Send Unlisten [UNL] to all devices
+  if ( gpibBus.sendCmd(GC_UNL) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send UNL"),"");
+#endif
+    return;
+  }
+
+  // Controller addresses itself as listner
+  if ( gpibBus.sendCmd(GC_LAD + gpibBus.cfg.caddr) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send LAD"),"");
+#endif
+    return;
+  }
+
+  // Send Serial Poll Enable [SPE] to all devices
+  if ( gpibBus.sendCmd(GC_SPE) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send SPE"),"");
+#endif
+    return;
+  }
+
+  // Poll GPIB address or addresses as set by i and j
+  for (int i = 0; i < j; i++) {
+
+    // Set GPIB address in val
+    if (all) {
+      addrval = i;
+    } else {
+      addrval = addrs[i];
+    }
+
+    // Don't need to poll own address
+    if (addrval != gpibBus.cfg.caddr) {
+
+      // Address a device to talk
+      if ( gpibBus.sendCmd(GC_TAD + addrval) )  {
+
+#ifdef DEBUG_SPOLL
+        DB_PRINT(F("failed to send TAD"),"");
+#endif
+        return;
+      }
+
+      // Set GPIB control to controller active listner state (ATN unasserted)
+      gpibBus.setControls(CLAS);
+
+      // Read the response byte (usually device status) using handshake - suppress EOI detection
+      r = gpibBus.readByte(&sb, false, &eoiDetected);
+
+      // If we successfully read a byte
+      if (!r) {
+        if (j == 30) {
+          // If all, return specially formatted response: SRQ:addr,status
+          // but only when RQS bit set
+          if (sb & 0x40) {
+            dataPort.print(F("SRQ:")); dataPort.print(i); dataPort.print(F(",")); dataPort.println(sb, DEC);
+            // Exit on first device to respond
+            i = j;
+          }
+        } else {
+          // Return decimal number representing status byte
+          dataPort.println(sb, DEC);
+          if (isVerb) {
+            dataPort.print(F("Received status byte ["));
+            dataPort.print(sb);
+            dataPort.print(F("] from device at address: "));
+            dataPort.println(addrval);
+          }
+          // Exit on first device to respond
+          i = j;
+        }
+      } else {
+        if (isVerb) dataPort.println(F("Failed to retrieve status byte"));
+      }
+    }
+  }
+  if (all) dataPort.println();
+
+  // Send Serial Poll Disable [SPD] to all devices
+  if ( gpibBus.sendCmd(GC_SPD) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send SPD"),"");
+#endif
+    return;
+  }
+
+  // Send Untalk [UNT] to all devices
+  if ( gpibBus.sendCmd(GC_UNT) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send UNT"),"");
+#endif
+    return;
+  }
+
+  // Unadress listners [UNL] to all devices
+  if ( gpibBus.sendCmd(GC_UNL) )  {
+#ifdef DEBUG_SPOLL
+    DB_PRINT(F("failed to send UNL"),"");
+#endif
+    return;
+  }
+
+  // Set GPIB control to controller idle state
+  gpibBus.setControls(CIDS);
+
+  // Set SRQ to status of SRQ line. Should now be unasserted but, if it is
+  // still asserted, then another device may be requesting service so another
+  // serial poll will be called from the main loop
+/*  FLAG NO LONGER USED = NOW CHECKING STATUS OF LINE
+  if (digitalRead(SRQ) == LOW) {
+    isSRQ = true;
+  } else {
+    isSRQ = false;
+  }
+*/
+  if (isVerb) dataPort.println(F("Serial poll completed."));
+
+}
+
+
+/***** Return status of SRQ line *****/
+void srq_h() {
+  //NOTE: LOW=0=asserted, HIGH=1=unasserted
+//  dataPort.println(!digitalRead(SRQ));
+  dataPort.println(gpibBus.isAsserted(SRQ));
+}
+
+
+/***** Set the status byte (device mode) *****/
+void stat_h(char *params) {
+  uint16_t statusByte = 0;
+  // A parameter given?
+  if (params != NULL) {
+    // Byte value given?
+    if (notInRange(params, 0, 255, statusByte)) return;
+#ifdef USE_TXFIFO
+    // Status byte of the address selected with ++devaddr use
+    if (devSel) {
+      devStat[devSel] = (uint8_t)statusByte;
+    } else {
+      gpibBus.setStatus((uint8_t)statusByte);
+    }
+    devUpdateSrq();
+#else
+    gpibBus.setStatus((uint8_t)statusByte);
+#endif
+  } else {
+    // Return the currently set status byte
+#ifdef USE_TXFIFO
+    if (devSel) {
+      dataPort.println(devStat[devSel]);
+      return;
+    }
+#endif
+    dataPort.println(gpibBus.cfg.stat);
+  }
+}
+
+
+/***** Save controller configuration *****/
+void save_h() {
+#ifdef E2END
+  epSlotWrite(EESLOT_STARTUP, gpibBus.cfg.db, GPIB_CFG_SIZE);
+  if (isVerb) dataPort.println(F("Settings saved."));
+#else
+  dataPort.println(F("EEPROM not supported."));
+#endif
+}
+
+
+/***** Save, load, delete or list named configurations *****/
+/*
+ * ++cfg save name - save current configuration to a named EEPROM slot
+ * ++cfg load name - load a named configuration
+ * ++cfg del name  - delete a named configuration
+ * ++cfg [list]    - list saved configurations
+ */
+void cfg_h(char *params) {
+#ifdef E2END
+  char *keyword = NULL;
+  char *name;
+  uint8_t cmode = gpibBus.cfg.cmode;
+
+  if (params != NULL) keyword = strtok(params, " \t");
+
+  if ( (keyword == NULL) || (strncasecmp(keyword, "list", 4) == 0) ) {
+    epSlotList(dataPort, GPIB_CFG_SIZE);
+    return;
+  }
+
+  name = strtok(NULL, " \t");
+  if ( (name == NULL) || (strlen(name) >= EESLOT_NAMELEN) ) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("A name of 1 - 9 characters is required"));
+    return;
+  }
+
+  if (strncasecmp(keyword, "save", 4) == 0) {
+    if (!epSlotWrite(name, gpibBus.cfg.db, GPIB_CFG_SIZE)) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("No free configuration slot!"));
+      return;
+    }
+    if (isVerb) dataPort.println(F("Settings saved."));
+    return;
+  }
+
+  if (strncasecmp(keyword, "load", 4) == 0) {
+    if (!epSlotRead(name, gpibBus.cfg.db, GPIB_CFG_SIZE)) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Configuration not found!"));
+      return;
+    }
+    // Restart the bus only if the interface mode has changed
+    if (gpibBus.cfg.cmode != cmode) gpibBus.begin();
+    if (isVerb) dataPort.println(F("Settings loaded."));
+    return;
+  }
+
+  if (strncasecmp(keyword, "del", 3) == 0) {
+    if (!epSlotErase(name, GPIB_CFG_SIZE)) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Configuration not found!"));
+    }
+    return;
+  }
+
+  errBadCmd();
+#else
+  params = params;
+  dataPort.println(F("EEPROM not supported."));
+#endif
+}
+
+
+/***** Show state or enable/disable listen only mode *****/
+void lon_h(char *params) {
+  uint16_t lval;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, lval)) return;
+    isRO = lval ? true : false;
+    if (isRO) {
+      isTO = 0;       // Talk-only mode must be disabled!
+      isProm = false; // Promiscuous mode must be disabled!
+#ifdef USE_ANALYZER
+      isCapture = false;  // Capture mode must be disabled!
+#endif
+    }
+    if (isVerb) {
+      dataPort.print(F("LON: "));
+      dataPort.println(lval ? "ON" : "OFF") ;
+    }
+  } else {
+    dataPort.println(isRO);
+  }
+}
+
+
+/***** Show help message *****/
+void help_h(char *params) {
+  char c, t;
+  char token[20];
+  uint8_t i;
+
+  i = 0;
+  for (size_t k = 0; k < strlen_P(cmdHelp); k++) {
+    c = pgm_read_byte_near(cmdHelp + k);
+
+
+    if (i < 20) {
+      if(c == ':') {
+        token[i] = 0;
+        if((params == NULL) || (strcmp(token, params) == 0)) {
+          dataPort.print(F("++"));
+          dataPort.print(token);
+          dataPort.print(c);
+          k++;
+          t = pgm_read_byte_near(cmdHelp + k);
+          dataPort.print(F(" ["));
+          dataPort.print(t);
+          dataPort.print(F("]"));
+          i = 255; // means we need to print until \n
+        }
+        
+      } else {
+        token[i] = c;
+        i++;
+      }
+    } else if (i == 255) {
+      dataPort.print(c);
+    }
+    if (c == '\n') {
+      i = 0;
+    }
+  }
+}
+
+
+
+
+
+/***********************************/
+/***** CUSTOM COMMAND HANDLERS *****/
+/***********************************/
+
+/***** All serial poll *****/
+/*
+ * Polls all devices, not just the currently addressed instrument
+ * This is an alias wrapper for ++spoll all
+ */
+void aspoll_h() {
+  //  char all[4];
+  //  strcpy(all, "all\0");
+  spoll_h((char*)"all");
+}
+
+
+/***** Send Universal Device Clear *****/
+/*
+ * The universal Device Clear (DCL) is unaddressed and affects all devices on the Gpib bus.
+ */
+void dcl_h() {
+  if ( gpibBus.sendCmd(GC_DCL) )  {
+    if (isVerb) dataPort.println(F("Sending DCL failed"));
+    return;
+  }
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+}
+
+
+/***** Re-load default configuration *****/
+void default_h() {
+  gpibBus.setDefaultCfg();
+}
+
+
+/***** Show or set end of receive character(s) *****/
+void eor_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 15, val)) return;
+    gpibBus.cfg.eor = (uint8_t)val;
+    if (isVerb) {
+      dataPort.print(F("Set EOR to: "));
+      dataPort.println(val);
+    };
+  } else {
+    if (gpibBus.cfg.eor>7) gpibBus.cfg.eor = 0;  // Needed to reset FF read from EEPROM after FW upgrade
+    dataPort.println(gpibBus.cfg.eor);
+  }
+}
+
+
+/***** Show or clear the main loop profile *****/
+/*
+ * ++perf      - show loop period (min avg max) and time spent in each section
+ * ++perf clr  - clear the profile
+ */
+void perf_h(char *params) {
+#ifdef USE_PERF
+  uint8_t i;
+
+  if (params != NULL) {
+    if (strncasecmp(params, "clr", 3) == 0) {
+      perfClear();
+    } else {
+      errBadCmd();
+    }
+    return;
+  }
+
+  if (isVerb) dataPort.println(F("loop: min avg max us, loops"));
+  dataPort.print(F("loop: "));
+  dataPort.print(perfLoops ? perfMin : 0);
+  dataPort.print(' ');
+  dataPort.print(perfLoops ? (perfSum / perfLoops) : 0);
+  dataPort.print(' ');
+  dataPort.print(perfMax);
+  dataPort.print(F(", "));
+  dataPort.println(perfLoops);
+
+  if (isVerb) dataPort.println(F("section: total max us"));
+  for (i = 0; i < PERF_SECTIONS; i++) {
+    switch (i) {
+      case PERF_CMD:
+        dataPort.print(F("cmd: "));
+        break;
+      case PERF_CTRL:
+        dataPort.print(F("ctrl: "));
+        break;
+      case PERF_DEVICE:
+        dataPort.print(F("device: "));
+        break;
+      case PERF_SERIAL:
+        dataPort.print(F("serial: "));
+        break;
+    }
+    dataPort.print(perfTotal[i]);
+    dataPort.print(' ');
+    dataPort.println(perfPeak[i]);
+  }
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+
+/***** Send or clear the trace buffer *****/
+void trace_h(char *params) {
+#ifdef TRACE_ENABLE
+  if (params != NULL) {
+    if (strncasecmp(params, "clr", 3) == 0) {
+      traceClear();
+    } else {
+      errBadCmd();
+    }
+    return;
+  }
+  traceDump(dataPort);
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+
+/***** Show or clear bus statistics *****/
+/*
+ * ++stats      - show handshake histograms and per-address counters
+ * ++stats clr  - clear all statistics
+ */
+void stats_h(char *params) {
+#ifdef USE_STATS
+  uint8_t i, j;
+
+  if (params != NULL) {
+    if (strncasecmp(params, "clr", 3) == 0) {
+      gpibBus.statsClear();
+    } else {
+      errBadCmd();
+    }
+    return;
+  }
+
+  // Handshake stage histograms
+  if (isVerb) dataPort.println(F("stage: <8 <32 <128 <512 <2048 <8192 <32768 >=32768 us"));
+  for (i = 0; i < STAT_STAGES; i++) {
+    switch (i) {
+      case STAT_DAV:
+        dataPort.print(F("DAV:"));
+        break;
+      case STAT_NRFD:
+        dataPort.print(F("NRFD:"));
+        break;
+      case STAT_NDAC:
+        dataPort.print(F("NDAC:"));
+        break;
+    }
+    for (j = 0; j < STAT_BINS; j++) {
+      dataPort.print(' ');
+      dataPort.print(gpibBus.statHist[i][j]);
+    }
+    dataPort.println();
+  }
+
+  // Per-address counters
+  if (isVerb) dataPort.println(F("addr: bytes timeouts aborts"));
+  for (i = 0; i < STAT_ADDRS; i++) {
+    if ( (gpibBus.statBytes[i] == 0) && (gpibBus.statTmo[i] == 0) && (gpibBus.statAbort[i] == 0) ) continue;
+    dataPort.print(i);
+    dataPort.print(F(": "));
+    dataPort.print(gpibBus.statBytes[i]);
+    dataPort.print(' ');
+    dataPort.print(gpibBus.statTmo[i]);
+    dataPort.print(' ');
+    dataPort.println(gpibBus.statAbort[i]);
+  }
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+
+/***** Show or set a custom read terminator *****/
+/*
+ * ++term               - show the current terminator
+ * ++term eor           - use the terminator selected by ++eor
+ * ++term seq b [b...]  - stop reading after a sequence of up to 8 bytes
+ * ++term set b [b...]  - stop reading after any one of the given bytes
+ * Bytes are given as decimal values (0-255)
+ */
+void term_h(char *params) {
+  char *keyword = NULL;
+  char *param;
+  uint8_t buf[32];
+  uint8_t len = 0;
+  uint16_t val;
+
+  if (params != NULL) keyword = strtok(params, " \t");
+
+  if (keyword == NULL) {
+    switch (gpibBus.getTermType()) {
+      case TERM_SEQ:
+        dataPort.print(F("seq"));
+        len = gpibBus.getTermSeq(buf);
+        for (uint8_t i=0; i<len; i++) {
+          dataPort.print(' ');
+          dataPort.print(buf[i]);
+        }
+        break;
+      case TERM_SET:
+        dataPort.print(F("set"));
+        for (uint16_t i=0; i<256; i++) {
+          if (gpibBus.isTermByte((uint8_t)i)) {
+            dataPort.print(' ');
+            dataPort.print(i);
+          }
+        }
+        break;
+      default:
+        dataPort.print(F("eor"));
+    }
+    dataPort.println();
+    return;
+  }
+
+  if (strncasecmp(keyword, "eor", 3) == 0) {
+    gpibBus.setTermEor();
+    return;
+  }
+
+  if (strncasecmp(keyword, "seq", 3) == 0) {
+    param = strtok(NULL, " \t");
+    while (param != NULL) {
+      if (len == TERM_MAXLEN) {
+        errBadCmd();
+        if (isVerb) dataPort.println(F("Sequence too long"));
+        return;
+      }
+      if (notInRange(param, 0, 255, val)) return;
+      buf[len] = (uint8_t)val;
+      len++;
+      param = strtok(NULL, " \t");
+    }
+    if (len == 0) {
+      errBadCmd();
+      return;
+    }
+    gpibBus.setTermSeq(buf, len);
+    return;
+  }
+
+  if (strncasecmp(keyword, "set", 3) == 0) {
+    memset(buf, 0, sizeof(buf));
+    param = strtok(NULL, " \t");
+    while (param != NULL) {
+      if (notInRange(param, 0, 255, val)) return;
+      buf[val>>3] |= (1<<(val&7));
+      len++;
+      param = strtok(NULL, " \t");
+    }
+    if (len == 0) {
+      errBadCmd();
+      return;
+    }
+    gpibBus.setTermSet(buf);
+    return;
+  }
+
+  errBadCmd();
+}
+
+
+/***** Parallel Poll Handler *****/
+/*
+ * Device must be set to respond on DIO line 1 - 8
+ */
+void ppoll_h() {
+  uint8_t sb = 0;
+
+  // Poll devices
+  // Start in controller idle state
+  gpibBus.setControls(CIDS);
+  delayMicroseconds(20);
+  // Assert ATN and EOI
+  gpibBus.setControlVal(0b00000000, 0b10010000, 0);
+  //  setGpibState(0b10010000, 0b00000000, 0b10010000);
+  delayMicroseconds(20);
+  // Read data byte from GPIB bus without handshake
+  sb = readGpibDbus();
+  // Return to controller idle state (ATN and EOI unasserted)
+  gpibBus.setControls(CIDS);
+
+  // Output the response byte
+  dataPort.println(sb, DEC);
+
+  if (isVerb) dataPort.println(F("Parallel poll completed."));
+}
+
+
+/***** Assert or de-assert REN 0=de-assert; 1=assert *****/
+void ren_h(char *params) {
+#if defined (SN7516X) && not defined (SN7516X_DC)
+  params = params;
+  dataPort.println(F("Unavailable")) ;
+#else
+  // char *stat;
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, val)) return;
+    digitalWrite(REN, (val ? LOW : HIGH));
+    if (isVerb) {
+      dataPort.print(F("REN: "));
+      dataPort.println(val ? "REN asserted" : "REN un-asserted") ;
+    };
+  } else {
+    dataPort.println(digitalRead(REN) ? 0 : 1);
+  }
+#endif
+}
+
+
+/***** Enable verbose mode 0=OFF; 1=ON *****/
+void verb_h() {
+  isVerb = !isVerb;
+  dataPort.print("Verbose: ");
+  dataPort.println(isVerb ? "ON" : "OFF");
+}
+
+
+/***** Set version string *****/
+/* Replace the standard AR488 version string with something else
+ *  NOTE: some instrument software requires a sepcific version string to ID the interface
+ */
+void setvstr_h(char *params) {
+  uint8_t plen;
+  char idparams[64];
+  plen = strlen(params);
+  memset(idparams, '\0', 64);
+  strncpy(idparams, "verstr ", 7);
+  if (plen>47) plen = 47; // Ignore anything over 47 characters
+  strncat(idparams, params, plen);
+
+  id_h(idparams);
+  
+/*  
+  if (params != NULL) {
+    len = strlen(params);
+    if (len>47) len=47; 
+    memset(AR488.vstr, '\0', 48);
+    strncpy(AR488.vstr, params, len);
+    if (isVerb) {
+      dataPort.print(F("Changed version string to: "));
+      dataPort.println(params);
+    };
+  }
+*/  
+}
+
+
+/***** Show state or enable/disable promiscuous mode *****/
+void prom_h(char *params) {
+  uint16_t pval;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, pval)) return;
+    isProm = pval ? true : false;
+    if (isProm) {
+      isTO = 0;     // Talk-only mode must be disabled!
+      isRO = false; // Listen-only mode must be disabled!
+#ifdef USE_ANALYZER
+      isCapture = false;  // Capture mode must be disabled!
+#endif
+    }
+    if (isVerb) {
+      dataPort.print(F("PROM: "));
+      dataPort.println(pval ? "ON" : "OFF") ;
+    }
+  } else {
+    dataPort.println(isProm);
+  }
+}
+
+
+
+/***** Show state or enable/disable bus analyzer capture mode *****/
+void capture_h(char *params) {
+#ifdef USE_ANALYZER
+  uint16_t cval;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, cval)) return;
+    isCapture = cval ? true : false;
+    if (isCapture) {
+      isTO = 0;       // Talk-only mode must be disabled!
+      isRO = false;   // Listen-only mode must be disabled!
+      isProm = false; // Promiscuous mode must be disabled!
+    }
+    if (isVerb) {
+      dataPort.print(F("Capture: "));
+      dataPort.println(cval ? "ON" : "OFF") ;
+    }
+  } else {
+    dataPort.println(isCapture);
+  }
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
+}
+
+
+/***** Talk only mode *****/
+void ton_h(char *params) {
+  uint16_t toval;
+  if (params != NULL) {
+    if (notInRange(params, 0, 2, toval)) return;
+//    isTO = val ? true : false;
+    isTO = (uint8_t)toval;
+    if (isTO>0) {
+      isRO = false;   // Read-only mode must be disabled in TO mode!
+      isProm = false; // Promiscuous mode must be disabled in TO mode!
+#ifdef USE_ANALYZER
+      isCapture = false;  // Capture mode must be disabled in TO mode!
+#endif
+    }
+  }else{
+    if (isVerb) {
+      dataPort.print(F("TON: "));
+      switch (isTO) {
+        case 1:
+          dataPort.println(F("ON unbuffered"));
+          break;
+        case 2:
+          dataPort.println(F("ON buffered"));
+          break;
+        default:
+          dataPort.println(F("OFF"));
+      }
+    }
+    dataPort.println(isTO);
+  }
+}
+
+
+/***** SRQ auto - show or enable/disable automatic spoll on SRQ *****/
+/*
+ * In device mode, when the SRQ interrupt is triggered and SRQ
+ * auto is set to 1, a serial poll is conducted automatically
+ * and the status byte for the instrument requiring service is
+ * automatically returned. When srqauto is set to 0 (default)
+ * an ++spoll command needs to be given manually to return
+ * the status byte.
+ */
+void srqa_h(char *params) {
+  uint16_t val;
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, val)) return;
+    switch (val) {
+      case 0:
+        isSrqa = false;
+        break;
+      case 1:
+        isSrqa = true;
+        break;
+    }
+    if (isVerb) dataPort.println(isSrqa ? "SRQ auto ON" : "SRQ auto OFF") ;
+  } else {
+    dataPort.println(isSrqa);
+  }
+}
+
+
+/***** Repeat a given command and return result *****/
+void repeat_h(char *params) {
+
+  uint16_t count;
+  uint16_t tmdly;
+  char *param;
+
+  if (params != NULL) {
+    // Count (number of repetitions)
+    param = strtok(params, " \t");
+    if (strlen(param) > 0) {
+      if (notInRange(param, 2, 255, count)) return;
+    }
+    // Time delay (milliseconds)
+    param = strtok(NULL, " \t");
+    if (strlen(param) > 0) {
+      if (notInRange(param, 0, 30000, tmdly)) return;
+    }
+
+    // Pointer to remainder of parameters string
+    param = strtok(NULL, "\n\r");
+    if (strlen(param) > 0) {
+      for (uint16_t i = 0; i < count; i++) {
+        // Send string to instrument
+        gpibBus.sendData(param, strlen(param));
+        delay(tmdly);
+        readFromInstrument(gpibBus.cfg.eoi, false, 0);
+      }
+    } else {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
+    }
+  } else {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("Missing parameters"));
+  }
 
-/***** Re-load default configuration *****/
-void default_h() {
-  gpibBus.setDefaultCfg();
 }
 
 
-/***** Show or set end of receive character(s) *****/
-void eor_h(char *params) {
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 15, val)) return;
-    gpibBus.cfg.eor = (uint8_t)val;
-    if (isVerb) {
-      dataPort.print(F("Set EOR to: "));
-      dataPort.println(val);
-    };
-  } else {
-    if (gpibBus.cfg.eor>7) gpibBus.cfg.eor = 0;  // Needed to reset FF read from EEPROM after FW upgrade
-    dataPort.println(gpibBus.cfg.eor);
+/***** Run, define or list macros *****/
+/*
+ * ++macro n         - run macro n
+ * ++macro [list]    - list available macros
+ * ++macro list n    - show the text of macro n
+ * ++macro def n txt - define macro n (stored in EEPROM)
+ * ++macro del n     - delete macro n from EEPROM
+ * ++macro rec n     - record the following lines into macro n
+ * ++macro end       - stop recording
+ */
+void macro_h(char *params) {
+#ifdef USE_MACROS
+  uint16_t val;
+  const char * macro;
+  char *keyword = NULL;
+  char *param = NULL;
+#ifdef E2END
+  uint16_t eaddr;
+  uint16_t esize;
+#endif
+
+  if (params != NULL) keyword = strtok(params, " \t");
+
+  // Run a macro
+  if ( (keyword != NULL) && isDigit(keyword[0]) ) {
+    if (notInRange(keyword, 0, 9, val)) return;
+    //    execMacro((uint8_t)val);
+    runMacro = (uint8_t)val;
+    return;
+  }
+
+  // List macros
+  if ( (keyword == NULL) || (strncasecmp(keyword, "list", 4) == 0) ) {
+    param = strtok(NULL, " \t");
+    if (param != NULL) {
+      if (notInRange(param, 0, 9, val)) return;
+      showMacro((uint8_t)val);
+      return;
+    }
+    for (int i = 0; i < 10; i++) {
+      macro = (pgm_read_word(macros + i));
+      //      dataPort.print(i);dataPort.print(F(": "));
+#ifdef E2END
+      if ( (strlen_P(macro) > 0) || epMacroFind(i, eaddr, esize) ) {
+#else
+      if (strlen_P(macro) > 0) {
+#endif
+        dataPort.print(i);
+        dataPort.print(" ");
+      }
+    }
+    dataPort.println();
+    return;
+  }
+
+#ifdef E2END
+  // Stop recording
+  if (strncasecmp(keyword, "end", 3) == 0) {
+    if (macroRec < 10) {
+      if (isVerb) {
+        dataPort.print(F("Recorded macro "));
+        dataPort.println(macroRec);
+      }
+      macroRec = 10;
+    }
+    return;
+  }
+
+  // Remaining commands require a macro number
+  param = strtok(NULL, " \t");
+  if (param == NULL) {
+    errBadCmd();
+    if (isVerb) dataPort.println(F("Macro number required"));
+    return;
+  }
+  if (notInRange(param, 0, 9, val)) return;
+
+  // Define macro - the remainder of the line is the macro text
+  if (strncasecmp(keyword, "def", 3) == 0) {
+    // Only the last macro stored can grow, so the recording must stay last
+    if (macroRec < 10) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Not while recording a macro!"));
+      return;
+    }
+    param = param + strlen(param) + 1;
+    if (!epMacroWrite((uint8_t)val, param, strlen(param))) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Not enough space to store macro!"));
+      return;
+    }
+    if (isVerb) dataPort.println(F("Macro saved."));
+    return;
+  }
+
+  // Delete macro
+  if (strncasecmp(keyword, "del", 3) == 0) {
+    if (!epMacroErase((uint8_t)val)) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Macro not found!"));
+    }
+    return;
+  }
+
+  // Start recording
+  if (strncasecmp(keyword, "rec", 3) == 0) {
+    epMacroErase((uint8_t)val);
+    macroRec = (uint8_t)val;
+    if (isVerb) dataPort.println(F("Recording. Use ++macro end to finish."));
+    return;
   }
+#endif
+
+  errBadCmd();
+#else
+  memset(params, '\0', 5);
+  dataPort.println(F("Disabled"));
+#endif
 }
 
 
-/***** Parallel Poll Handler *****/
+/***** Command sequencer *****/
 /*
- * Device must be set to respond on DIO line 1 - 8
+ * ++seq add step [arg] - add a step to the end of the sequence
+ * ++seq run            - run the sequence
+ * ++seq stop           - stop the sequence
+ * ++seq clr            - clear the sequence
+ * ++seq [list]         - list the steps of the sequence
+ * ++seq save           - save the sequence to EEPROM
+ * ++seq load           - load the sequence from EEPROM
  */
-void ppoll_h() {
-  uint8_t sb = 0;
+void seq_h(char *params) {
+#ifdef USE_SEQUENCER
+  char *keyword = NULL;
+#ifdef E2END
+  uint16_t eaddr;
+  uint16_t esize;
+#endif
 
-  // Poll devices
-  // Start in controller idle state
-  gpibBus.setControls(CIDS);
-  delayMicroseconds(20);
-  // Assert ATN and EOI
-  gpibBus.setControlVal(0b00000000, 0b10010000, 0);
-  //  setGpibState(0b10010000, 0b00000000, 0b10010000);
-  delayMicroseconds(20);
-  // Read data byte from GPIB bus without handshake
-  sb = readGpibDbus();
-  // Return to controller idle state (ATN and EOI unasserted)
-  gpibBus.setControls(CIDS);
+  if (params != NULL) keyword = strtok(params, " \t");
 
-  // Output the response byte
-  dataPort.println(sb, DEC);
+  if ( (keyword == NULL) || (strncasecmp(keyword, "list", 4) == 0) ) {
+    seqList();
+    return;
+  }
 
-  if (isVerb) dataPort.println(F("Parallel poll completed."));
-}
+  if (strncasecmp(keyword, "add", 3) == 0) {
+    seqAdd(keyword + strlen(keyword) + 1);
+    return;
+  }
 
+  if (strncasecmp(keyword, "run", 3) == 0) {
+    if (seqLen == 0) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Sequence is empty"));
+      return;
+    }
+    seqStart();
+    return;
+  }
 
-/***** Assert or de-assert REN 0=de-assert; 1=assert *****/
-void ren_h(char *params) {
-#if defined (SN7516X) && not defined (SN7516X_DC)
-  params = params;
-  dataPort.println(F("Unavailable")) ;
-#else
-  // char *stat;
-  uint16_t val;
-  if (params != NULL) {
-    if (notInRange(params, 0, 1, val)) return;
-    digitalWrite(REN, (val ? LOW : HIGH));
-    if (isVerb) {
-      dataPort.print(F("REN: "));
-      dataPort.println(val ? "REN asserted" : "REN un-asserted") ;
-    };
-  } else {
-    dataPort.println(digitalRead(REN) ? 0 : 1);
+  if (strncasecmp(keyword, "stop", 4) == 0) {
+    seqRun = false;
+    return;
   }
-#endif
-}
 
+  if (strncasecmp(keyword, "clr", 3) == 0) {
+    seqRun = false;
+    seqLen = 0;
+    seqProg[0] = SQ_END;
+    return;
+  }
 
-/***** Enable verbose mode 0=OFF; 1=ON *****/
-void verb_h() {
-  isVerb = !isVerb;
-  dataPort.print("Verbose: ");
-  dataPort.println(isVerb ? "ON" : "OFF");
+#ifdef E2END
+  if (strncasecmp(keyword, "save", 4) == 0) {
+    // The sequence is stored with the macros, after the one being recorded
+    if (macroRec < 10) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Not while recording a macro!"));
+      return;
+    }
+    if (!epMacroWrite(EEMACRO_SEQ, (char *)seqProg, seqLen)) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Not enough space to store sequence!"));
+      return;
+    }
+    if (isVerb) dataPort.println(F("Sequence saved."));
+    return;
+  }
+
+  if (strncasecmp(keyword, "load", 4) == 0) {
+    if ( !epMacroFind(EEMACRO_SEQ, eaddr, esize) || (esize >= SEQ_SIZE) ) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("No saved sequence!"));
+      return;
+    }
+    seqRun = false;
+    for (uint16_t i = 0; i < esize; i++) {
+      seqProg[i] = epMacroChar(eaddr + i);
+    }
+    seqLen = esize;
+    seqProg[seqLen] = SQ_END;
+    if (!seqIsValid()) {
+      seqLen = 0;
+      seqProg[0] = SQ_END;
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Saved sequence is not valid!"));
+    }
+    return;
+  }
+#endif
+
+  errBadCmd();
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
 }
 
 
-/***** Set version string *****/
-/* Replace the standard AR488 version string with something else
- *  NOTE: some instrument software requires a sepcific version string to ID the interface
+/***** Instrument probing *****/
+/*
+ * ++probe [addr [query]] - probe addr (default: current address) with
+ *                          query (default: *IDN?) and keep its profile
+ * ++probe list           - list profiles
+ * ++probe del addr       - delete the profile for addr
+ * ++probe clr            - delete all profiles
  */
-void setvstr_h(char *params) {
-  uint8_t plen;
-  char idparams[64];
-  plen = strlen(params);
-  memset(idparams, '\0', 64);
-  strncpy(idparams, "verstr ", 7);
-  if (plen>47) plen = 47; // Ignore anything over 47 characters
-  strncat(idparams, params, plen);
+void probe_h(char *params) {
+#ifdef USE_PROBE
+  char *keyword = NULL;
+  char *param;
+  char *pend = NULL;
+  char idn[] = "*IDN?";
+  uint16_t val;
+  uint8_t i;
 
-  id_h(idparams);
-  
-/*  
   if (params != NULL) {
-    len = strlen(params);
-    if (len>47) len=47; 
-    memset(AR488.vstr, '\0', 48);
-    strncpy(AR488.vstr, params, len);
-    if (isVerb) {
-      dataPort.print(F("Changed version string to: "));
-      dataPort.println(params);
-    };
+    pend = params + strlen(params);
+    keyword = strtok(params, " \t");
   }
-*/  
-}
 
+  if (keyword == NULL) {
+    probeRun(gpibBus.cfg.paddr, idn);
+    return;
+  }
 
-/***** Show state or enable/disable promiscuous mode *****/
-void prom_h(char *params) {
-  uint16_t pval;
-  if (params != NULL) {
-    if (notInRange(params, 0, 1, pval)) return;
-    isProm = pval ? true : false;
-    if (isProm) {
-      isTO = 0;     // Talk-only mode must be disabled!
-      isRO = false; // Listen-only mode must be disabled!
+  if (strncasecmp(keyword, "list", 4) == 0) {
+    for (i = 0; i < PROBE_ENTRIES; i++) {
+      if (probeTab[i].addr) probeShow(i);
     }
-    if (isVerb) {
-      dataPort.print(F("PROM: "));
-      dataPort.println(pval ? "ON" : "OFF") ;
+    return;
+  }
+
+  if (strncasecmp(keyword, "clr", 3) == 0) {
+    for (i = 0; i < PROBE_ENTRIES; i++) {
+      probeTab[i].addr = 0;
     }
-  } else {
-    dataPort.println(isProm);
+    return;
+  }
+
+  if (strncasecmp(keyword, "del", 3) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
+    }
+    if (notInRange(param, 1, 30, val)) return;
+    i = probeFind((uint8_t)val);
+    if (i != 0xFF) probeTab[i].addr = 0;
+    return;
   }
+
+  // Address followed by optional query - remainder of the line
+  if (notInRange(keyword, 1, 30, val)) return;
+  param = keyword + strlen(keyword);
+  if (param < pend) param++;
+  while ( (*param == ' ') || (*param == '\t') ) param++;
+  probeRun((uint8_t)val, (strlen(param) > 0) ? param : idn);
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
 }
 
 
+/***** Timed acquisition *****/
+/*
+ * ++poll add addr period query - read addr every period milliseconds
+ * ++poll del n                 - delete entry n
+ * ++poll clr                   - delete all entries
+ * ++poll start                 - start acquisition
+ * ++poll stop                  - stop acquisition
+ * ++poll [list]                - list entries
+ */
+void poll_h(char *params) {
+#ifdef USE_POLLER
+  char *keyword = NULL;
+  char *param;
+  uint16_t val;
+  uint32_t period;
+  uint8_t i;
 
-/***** Talk only mode *****/
-void ton_h(char *params) {
-  uint16_t toval;
-  if (params != NULL) {
-    if (notInRange(params, 0, 2, toval)) return;
-//    isTO = val ? true : false;
-    isTO = (uint8_t)toval;
-    if (isTO>0) {
-      isRO = false;   // Read-only mode must be disabled in TO mode!
-      isProm = false; // Promiscuous mode must be disabled in TO mode!
+  if (params != NULL) keyword = strtok(params, " \t");
+
+  if ( (keyword == NULL) || (strncasecmp(keyword, "list", 4) == 0) ) {
+    for (i = 0; i < POLL_ENTRIES; i++) {
+      if (pollTab[i].addr == 0) continue;
+      dataPort.print(i);
+      dataPort.print(F(": "));
+      dataPort.print(pollTab[i].addr);
+      dataPort.print(' ');
+      dataPort.print(pollTab[i].ticks * POLL_TICK_MS);
+      dataPort.print(' ');
+      dataPort.println(pollTab[i].query);
     }
-  }else{
-    if (isVerb) {
-      dataPort.print(F("TON: "));
-      switch (isTO) {
-        case 1:
-          dataPort.println(F("ON unbuffered"));
-          break;
-        case 2:
-          dataPort.println(F("ON buffered"));
-          break;
-        default:
-          dataPort.println(F("OFF"));
+    return;
+  }
+
+  if (strncasecmp(keyword, "start", 5) == 0) {
+    pollStart();
+    return;
+  }
+
+  if (strncasecmp(keyword, "stop", 4) == 0) {
+    pollStop();
+    return;
+  }
+
+  if (strncasecmp(keyword, "clr", 3) == 0) {
+    pollStop();
+    for (i = 0; i < POLL_ENTRIES; i++) {
+      pollTab[i].addr = 0;
+    }
+    return;
+  }
+
+  if (strncasecmp(keyword, "del", 3) == 0) {
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameter"));
+      return;
+    }
+    if (notInRange(param, 0, POLL_ENTRIES-1, val)) return;
+    noInterrupts();
+    pollTab[val].addr = 0;
+    pollDue &= ~(1 << val);
+    interrupts();
+    return;
+  }
+
+  if (strncasecmp(keyword, "add", 3) == 0) {
+    // Address
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameters"));
+      return;
+    }
+    if (notInRange(param, 1, 30, val)) return;
+    // Period (milliseconds)
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("Missing parameters"));
+      return;
+    }
+    period = strtoul(param, NULL, 10) / POLL_TICK_MS;
+    if (period == 0) {
+      errBadCmd();
+      if (isVerb) {
+        dataPort.print(F("Minimum period is "));
+        dataPort.print(POLL_TICK_MS);
+        dataPort.println(F(" milliseconds"));
       }
+      return;
     }
-    dataPort.println(isTO);
+    // Query - remainder of the line
+    param = param + strlen(param) + 1;
+    if ( (strlen(param) == 0) || (strlen(param) >= POLL_QLEN) ) {
+      errBadCmd();
+      if (isVerb) {
+        dataPort.print(F("Query of 1 - "));
+        dataPort.print(POLL_QLEN-1);
+        dataPort.println(F(" characters required"));
+      }
+      return;
+    }
+    // Find a free entry
+    for (i = 0; i < POLL_ENTRIES; i++) {
+      if (pollTab[i].addr == 0) break;
+    }
+    if (i == POLL_ENTRIES) {
+      errBadCmd();
+      if (isVerb) dataPort.println(F("No free poll entry!"));
+      return;
+    }
+    noInterrupts();
+    strcpy(pollTab[i].query, param);
+    pollTab[i].ticks = period;
+    pollTab[i].remain = period;
+    pollTab[i].addr = (uint8_t)val;
+    interrupts();
+    if (isVerb) {
+      dataPort.print(F("Added entry "));
+      dataPort.println(i);
+    }
+    return;
   }
+
+  errBadCmd();
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
 }
 
 
-/***** SRQ auto - show or enable/disable automatic spoll on SRQ *****/
+/***** Enable or disable timestamped binary records *****/
 /*
- * In device mode, when the SRQ interrupt is triggered and SRQ
- * auto is set to 1, a serial poll is conducted automatically
- * and the status byte for the instrument requiring service is
- * automatically returned. When srqauto is set to 0 (default)
- * an ++spoll command needs to be given manually to return
- * the status byte.
+ * When enabled, data read from an instrument is sent in binary records:
+ * RS | addr | timestamp (4 bytes) | flags | length | data
  */
-void srqa_h(char *params) {
+void binrec_h(char *params) {
   uint16_t val;
   if (params != NULL) {
     if (notInRange(params, 0, 1, val)) return;
-    switch (val) {
-      case 0:
-        isSrqa = false;
-        break;
-      case 1:
-        isSrqa = true;
-        break;
-    }
-    if (isVerb) dataPort.println(isSrqa ? "SRQ auto ON" : "SRQ auto OFF") ;
+    isBinRec = val ? true : false;
+    if (isVerb) {
+      dataPort.print(F("Binary records: "));
+      dataPort.println(val ? "ON" : "OFF");
+    };
   } else {
-    dataPort.println(isSrqa);
+    dataPort.println(isBinRec);
   }
 }
 
 
-/***** Repeat a given command and return result *****/
-void repeat_h(char *params) {
-
-  uint16_t count;
-  uint16_t tmdly;
-  char *param;
-
+/***** Show or set numeric conversion of readings *****/
+/*
+ * 0 = off; 1 = IEEE-754 single precision; 2 = IEEE-754 double precision
+ */
+void numfmt_h(char *params) {
+#ifdef USE_NUMCONV
+  uint16_t val;
   if (params != NULL) {
-    // Count (number of repetitions)
-    param = strtok(params, " \t");
-    if (strlen(param) > 0) {
-      if (notInRange(param, 2, 255, count)) return;
-    }
-    // Time delay (milliseconds)
-    param = strtok(NULL, " \t");
-    if (strlen(param) > 0) {
-      if (notInRange(param, 0, 30000, tmdly)) return;
-    }
-
-    // Pointer to remainder of parameters string
-    param = strtok(NULL, "\n\r");
-    if (strlen(param) > 0) {
-      for (uint16_t i = 0; i < count; i++) {
-        // Send string to instrument
-        gpibBus.sendData(param, strlen(param));
-        delay(tmdly);
-        gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
-      }
-    } else {
-      errBadCmd();
-      if (isVerb) dataPort.println(F("Missing parameter"));
-      return;
-    }
+    if (notInRange(params, 0, 2, val)) return;
+    numFmt = (uint8_t)val;
+    if (isVerb) {
+      dataPort.print(F("Numeric conversion: "));
+      if (val == 0) dataPort.println(F("OFF"));
+      if (val == NUM_FLOAT32) dataPort.println(F("float32"));
+      if (val == NUM_FLOAT64) dataPort.println(F("float64"));
+    };
   } else {
-    errBadCmd();
-    if (isVerb) dataPort.println(F("Missing parameters"));
+    dataPort.println(numFmt);
   }
-
+#else
+  params = params;
+  dataPort.println(F("Disabled"));
+#endif
 }
 
 
-/***** Run a macro *****/
-void macro_h(char *params) {
-#ifdef USE_MACROS
+/***** Enable or disable compression of received data *****/
+/*
+ * Each read is sent as one compressed frame (see ZSTREAM)
+ */
+void compress_h(char *params) {
+#ifdef USE_COMPRESSION
   uint16_t val;
-  const char * macro;
-
   if (params != NULL) {
-    if (notInRange(params, 0, 9, val)) return;
-    //    execMacro((uint8_t)val);
-    runMacro = (uint8_t)val;
+    if (notInRange(params, 0, 1, val)) return;
+    isCompress = val ? true : false;
+    if (isVerb) {
+      dataPort.print(F("Compression: "));
+      dataPort.println(val ? "ON" : "OFF");
+    };
   } else {
-    for (int i = 0; i < 10; i++) {
-      macro = (pgm_read_word(macros + i));
-      //      dataPort.print(i);dataPort.print(F(": "));
-      if (strlen_P(macro) > 0) {
-        dataPort.print(i);
-        dataPort.print(" ");
-      }
-    }
-    dataPort.println();
+    dataPort.println(isCompress);
   }
 #else
-  memset(params, '\0', 5);
+  params = params;
   dataPort.println(F("Disabled"));
 #endif
 }
@@ -2401,13 +4528,19 @@ void attnRequired() {
       db = cmdbytes[i];
 
       // Device is addressed to listen
-      if (gpibBus.cfg.paddr == (db ^ 0x20)) { // MLA = db^0x20
+      if (devFind(db ^ 0x20) != NO_SLOT) { // MLA = db^0x20
+#ifdef USE_TXFIFO
+        devListen = devFind(db ^ 0x20);
+#endif
         atnstat |= 0x02;
         addressed = true;
         gpibBus.setControls(DLAS);
 
       // Device is addressed to talk
-      }else if (gpibBus.cfg.paddr == (db ^ 0x40)) { // MLA = db^0x40
+      }else if (devFind(db ^ 0x40) != NO_SLOT) { // MTA = db^0x40
+#ifdef USE_TXFIFO
+        devTalk = devFind(db ^ 0x40);
+#endif
         // Call talk handler to send data
         atnstat |= 0x04;
         addressed = true;
@@ -2576,13 +4709,34 @@ void execGpibCmd(uint8_t gpibcmd){
 
 /***** Device is addressed to listen - so listen *****/
 void device_listen_h(){
+#ifdef USE_RESPONDER
+  if (respUsed()) {
+    respListen();
+    return;
+  }
+#endif
+  devListenTag();
   // Receivedata params: stream, detectEOI, detectEndByte, endByte
+#ifdef USE_COMPRESSION
+  if (isCompress) {
+    zStream.begin(dataPort);
+    gpibBus.receiveData(zStream, false, false, 0x0);
+    zStream.end();
+    return;
+  }
+#endif
   gpibBus.receiveData(dataPort, false, false, 0x0);
 }
 
 
 /***** Device is addressed to talk - so send data *****/
 void device_talk_h(){
+#ifdef USE_RESPONDER
+  if (respTalk()) return;
+#endif
+#ifdef USE_TXFIFO
+  txSend(devTalk);
+#else
   DB_PRINT("LnRdy: ", lnRdy);
   DB_PRINT("Buffer: ", pBuf);
 //  if (lnRdy == 2) sendToInstrument(pBuf, pbPtr);
@@ -2590,9 +4744,282 @@ void device_talk_h(){
   // Flush the parse buffer and clear line ready flag
   flushPbuf();
   lnRdy = 0;
+#endif
+}
+
+
+/***** With more than one address, tell the host which one the data is for *****/
+void devListenTag() {
+#ifdef USE_TXFIFO
+  if (devMulti()) {
+    dataPort.print(devListen ? devAddr[devListen] : gpibBus.cfg.paddr);
+    dataPort.print(':');
+  }
+#endif
+}
+
+
+/***** Return the slot of an address the interface answers to *****/
+/*
+ * Slot 0 is the address set with ++addr. The others are added with
+ * ++devaddr. Returns NO_SLOT if the address is not one of ours.
+ */
+uint8_t devFind(uint8_t addr) {
+  if (addr == gpibBus.cfg.paddr) return 0;
+#ifdef USE_TXFIFO
+  for (uint8_t i = 1; i < DEV_ADDRS; i++) {
+    if ( devAddr[i] && (devAddr[i] == addr) ) return i;
+  }
+#endif
+  return NO_SLOT;
+}
+
+
+#ifdef USE_TXFIFO
+/***** Does the interface answer to more than one address? *****/
+bool devMulti() {
+  for (uint8_t i = 1; i < DEV_ADDRS; i++) {
+    if (devAddr[i]) return true;
+  }
+  return false;
+}
+
+
+/***** Assert SRQ while any address requests service *****/
+void devUpdateSrq() {
+  bool rqs = gpibBus.cfg.stat & 0x40;
+  for (uint8_t i = 1; i < DEV_ADDRS; i++) {
+    if ( devAddr[i] && (devStat[i] & 0x40) ) rqs = true;
+  }
+  gpibBus.setSrq(rqs);
+}
+#endif
+
+
+/***** Device mode replies sent without the host *****/
+/*
+ * A query from the controller that matches an entry set with ++resp is
+ * held back from the host. Its response is sent the next time the same
+ * address is addressed to talk, ahead of any data from the host.
+ */
+#ifdef USE_RESPONDER
+
+/***** Is any query/response pair set? *****/
+bool respUsed() {
+  for (uint8_t i = 0; i < RESP_ENTRIES; i++) {
+    if (respQry[i][0]) return true;
+  }
+  return false;
+}
+
+
+/***** Return the entry for a query (RESP_ENTRIES if there is none) *****/
+uint8_t respFind(const char *qry) {
+  uint8_t i;
+  for (i = 0; i < RESP_ENTRIES; i++) {
+    if ( respQry[i][0] && (strcasecmp(respQry[i], qry) == 0) ) break;
+  }
+  return i;
+}
+
+
+/***** Start passing on a message that is not in the table *****/
+void respRelease() {
+  devListenTag();
+#ifdef USE_COMPRESSION
+  if (isCompress) zStream.begin(dataPort);
+#endif
+}
+
+
+/***** Receive data, holding back a query that is in the table *****/
+void respListen() {
+  Stream *output = &dataPort;
+  char qry[RESP_QLEN + 1];
+  uint8_t slot = 0;
+  uint8_t i;
+
+#ifdef USE_TXFIFO
+  slot = devListen;
+#endif
+#ifdef USE_COMPRESSION
+  if (isCompress) output = &zStream;
+#endif
+  // A new message replaces a query that has not been answered
+  respPending[slot] = 0;
+  qryStream.begin(*output, respRelease);
+  gpibBus.receiveData(qryStream, false, false, 0x0);
+  if (qryStream.held()) {
+    qryStream.query(qry);
+    i = respFind(qry);
+    if (i < RESP_ENTRIES) {
+      respPending[slot] = i + 1;
+      return;
+    }
+    qryStream.release();
+  }
+#ifdef USE_COMPRESSION
+  if (isCompress) zStream.end();
+#endif
+}
+
+
+/***** Send the response to a query that was held back *****/
+bool respTalk() {
+  uint8_t slot = 0;
+  uint8_t i;
+
+#ifdef USE_TXFIFO
+  slot = devTalk;
+#endif
+  i = respPending[slot];
+  if (i == 0) return false;
+  respPending[slot] = 0;
+  gpibBus.sendData(respTxt[i-1], strlen(respTxt[i-1]));
+  return true;
+}
+
+#endif
+
+
+/***** Device mode output FIFO *****/
+/*
+ * There is one FIFO for each address the interface answers to. Data
+ * from the host is queued for the address selected with ++devaddr use
+ * (devSel) and sent when that address is addressed to talk (devTalk).
+ */
+#ifdef USE_TXFIFO
+
+/***** Number of free bytes in the output FIFO of a slot *****/
+uint16_t txFree(uint8_t slot) {
+  return TXFIFO_MASK - ((txTail[slot] - txHead[slot]) & TXFIFO_MASK);
+}
+
+
+/***** Add a byte to the output FIFO of a slot *****/
+void txPut(uint8_t slot, uint8_t db) {
+  uint16_t t = txTail[slot];
+  txFifo[slot][t] = db;
+  txEom[slot][t >> 3] &= ~(1 << (t & 7));
+  txTail[slot] = (t + 1) & TXFIFO_MASK;
+}
+
+
+/***** Send XON once the selected FIFO has room again *****/
+void txResume() {
+  if ( txXoff && (txFree(devSel) >= (TXFIFO_SIZE / 2)) ) {
+    dataPort.write(XON);
+    txXoff = false;
+  }
+}
+
+
+/***** Queue the parse buffer in the output FIFO of the selected address *****/
+/*
+ * A line ended by CR or LF ends a message: the EOS terminators are added
+ * and the last byte is marked to be sent with EOI. A full parse buffer is
+ * queued without ending the message.
+ */
+void txQueue(char *buffr, uint8_t dsize) {
+  bool eom = !dataBufferFull;
+  uint16_t last;
+  uint8_t i;
+
+  dataBufferFull = false;
+
+  if (txFree(devSel) < (uint16_t)dsize + 2) {
+    // No room for the line and terminators
+    txLost[devSel]++;
+    if (isVerb) dataPort.println(F("Output FIFO full - data discarded"));
+  }else{
+    for (i = 0; i < dsize; i++) {
+      // As sendData(): without EOI, CR, LF and ESC in the data are not sent
+      if (gpibBus.cfg.eoi || ((buffr[i] != CR) && (buffr[i] != LF) && (buffr[i] != ESC))) txPut(devSel, buffr[i]);
+    }
+    if (eom) {
+      if ((gpibBus.cfg.eos & 0x2) == 0) txPut(devSel, CR);
+      if ((gpibBus.cfg.eos & 0x1) == 0) txPut(devSel, LF);
+      // Mark the last byte, unless it has already been sent
+      if (txTail[devSel] != txHead[devSel]) {
+        last = (txTail[devSel] - 1) & TXFIFO_MASK;
+        txEom[devSel][last >> 3] |= (1 << (last & 7));
+      }
+    }
+    txOpen[devSel] = !eom;
+  }
+
+  // Ask the host to pause
+  if ( TXFIFO_XOFF && !txXoff && (txFree(devSel) < TXFIFO_XOFF) ) {
+    dataPort.write(XOFF);
+    txXoff = true;
+  }
+
+  flushPbuf();
+  lnRdy = 0;
+}
+
+
+/***** Send the output FIFO of a slot to the controller *****/
+/*
+ * Sends bytes up to and including the end of the next message. When the
+ * FIFO of the selected slot runs empty first, data from the host is queued
+ * while waiting until the read timeout expires, the controller asserts ATN
+ * or a command is received from the host. The FIFO of any other slot can
+ * not be filled while waiting, so the wait ends at once.
+ */
+void txSend(uint8_t slot) {
+  unsigned long startMillis = millis();
+  uint16_t h;
+  bool eom;
+
+  // Line received but not yet queued
+  if (lnRdy == 2) txQueue(pBuf, pbPtr);
+
+  while (true) {
+
+    h = txHead[slot];
+
+    if (h == txTail[slot]) {
+      // Only the selected slot is filled by the host
+      if (slot != devSel) break;
+      // Wait for the host to send more of the message
+      if (gpibBus.isAsserted(ATN) || gpibBus.isAsserted(IFC)) break;
+      if ((millis() - startMillis) >= (unsigned long)gpibBus.cfg.rtmo) break;
+      if (dataPort.available()) {
+        lnRdy = serialIn_h();
+        if (lnRdy == 2) txQueue(pBuf, pbPtr);
+        // Leave commands for the main loop
+        if (lnRdy == 1) break;
+      }
+      continue;
+    }
+
+    eom = txEom[slot][h >> 3] & (1 << (h & 7));
+    // Stop on ATN, IFC or timeout - the byte is sent next time
+    if (gpibBus.writeByte(txFifo[slot][h], eom)) break;
+    txHead[slot] = (h + 1) & TXFIFO_MASK;
+    startMillis = millis();
+
+    // Let the host continue
+    txResume();
+
+    if (eom) break;
+  }
 }
 
 
+/***** Empty the output FIFO of a slot *****/
+void txClear(uint8_t slot) {
+  txHead[slot] = 0;
+  txTail[slot] = 0;
+  txLost[slot] = 0;
+  txOpen[slot] = false;
+  txResume();
+}
+
+#endif
+
+
 /***** Selected Device Clear *****/
 void device_sdc_h() {
   // If being addressed then reset
@@ -2620,6 +5047,17 @@ void device_spd_h() {
 void device_spe_h() {
 #ifdef DEBUG_DEVICE_ATN
   DB_PRINT(F("Serial poll request received from controller ->"),"");
+#endif
+#ifdef USE_TXFIFO
+  if (devTalk) {
+    // Polled at one of the other addresses - send its status byte
+    gpibBus.setControls(DTAS);
+    gpibBus.writeByte(devStat[devTalk], NO_EOI);
+    gpibBus.setControls(DIDS);
+    devStat[devTalk] &= ~0x40;
+    devUpdateSrq();
+    return;
+  }
 #endif
   gpibBus.sendStatus();
 #ifdef DEBUG_DEVICE_ATN
@@ -2632,6 +5070,10 @@ void device_spe_h() {
     DB_PRINT(F("SRQ bit cleared."),"");
 #endif
   }
+#ifdef USE_TXFIFO
+  // Keep SRQ asserted while another address requests service
+  devUpdateSrq();
+#endif
 }
 
 
@@ -2712,6 +5154,129 @@ void lonMode(){
 }
 
 
+/***** Bus analyzer *****/
+/*
+ * Listens to all bus traffic like lonMode but keeps the state of the
+ * control lines and the time of each byte. Records are placed in a ring
+ * buffer as the bytes are read and passed to the host when the serial
+ * port can take them without blocking, or when the bus is idle. Each
+ * record sent to the host is 6 bytes:
+ *   flags | data | timestamp (micros, 4 bytes, low byte first)
+ * Flags: bit 0 = ATN, 1 = EOI, 2 = SRQ, 3 = REN, 4 = IFC
+ * When records are lost because the buffer is full, a record with flag
+ * bit 7 set is sent once there is room, carrying the number of lost
+ * records in place of the timestamp.
+ */
+#ifdef USE_ANALYZER
+
+#define ANA_ATN 0x01
+#define ANA_EOI 0x02
+#define ANA_SRQ 0x04
+#define ANA_REN 0x08
+#define ANA_IFC 0x10
+#define ANA_LOST 0x80
+#define ANA_IDLE_US 1000    // Wait for a byte before the bus is considered idle
+
+struct anaRec {
+  uint8_t flags;            // Line states (ANA_xxx)
+  uint8_t data;             // Data byte
+  uint32_t time;            // Timestamp (micros)
+};
+
+anaRec anaBuf[ANA_RECORDS];
+uint8_t anaHead = 0;        // Next record to write
+uint8_t anaCount = 0;       // Number of records in buffer
+uint32_t anaLost = 0;       // Records lost since last reported
+
+
+/***** Send one 6 byte record to the host *****/
+void anaSend(uint8_t flags, uint8_t data, uint32_t val) {
+  dataPort.write(flags);
+  dataPort.write(data);
+  dataPort.write((uint8_t)val);
+  dataPort.write((uint8_t)(val >> 8));
+  dataPort.write((uint8_t)(val >> 16));
+  dataPort.write((uint8_t)(val >> 24));
+}
+
+
+/***** Send buffered records (all of them or only as many as fit) *****/
+void anaDrain(bool all) {
+  uint8_t tail;
+  if (anaLost && (all || (dataPort.availableForWrite() >= 6))) {
+    anaSend(ANA_LOST, 0, anaLost);
+    anaLost = 0;
+  }
+  while (anaCount && (all || (dataPort.availableForWrite() >= 6))) {
+    tail = (anaHead + ANA_RECORDS - anaCount) % ANA_RECORDS;
+    anaSend(anaBuf[tail].flags, anaBuf[tail].data, anaBuf[tail].time);
+    anaCount--;
+  }
+}
+
+
+void captureMode(){
+
+  uint8_t db = 0;
+  uint8_t r = 0;
+  uint8_t flags;
+  bool eoiDetected = false;
+
+  // Set bus for device read mode
+  gpibBus.setControls(DLAS);
+  anaCount = 0;
+  anaLost = 0;
+
+  while (isCapture) {
+
+    flags = gpibBus.isAsserted(ATN) ? ANA_ATN : 0;
+    r = gpibBus.readByte(&db, true, &eoiDetected, ANA_IDLE_US);
+    if (r == 0) {
+      if (anaCount < ANA_RECORDS) {
+        anaBuf[anaHead].time = micros();
+        if (eoiDetected) flags |= ANA_EOI;
+        if (gpibBus.isAsserted(SRQ)) flags |= ANA_SRQ;
+        if (gpibBus.isAsserted(REN)) flags |= ANA_REN;
+        if (gpibBus.isAsserted(IFC)) flags |= ANA_IFC;
+        anaBuf[anaHead].flags = flags;
+        anaBuf[anaHead].data = db;
+        anaHead = (anaHead + 1) % ANA_RECORDS;
+        anaCount++;
+      } else {
+        anaLost++;
+      }
+      // Send what the serial port can take without waiting
+      anaDrain(false);
+    } else {
+      // Bus idle - send everything
+      anaDrain(true);
+    }
+
+    // Check whether there are charaters waiting in the serial input buffer and call handler
+    if (dataPort.available()) {
+
+      lnRdy = serialIn_h();
+
+      // We have a command return to main loop and execute it
+      if (lnRdy==1) break;
+
+      // Clear the buffer to prevent it getting blocked
+      if (lnRdy==2) flushPbuf();
+
+    }
+
+  }
+
+  anaDrain(true);
+
+  // Set bus to idle
+  gpibBus.setControls(DIDS);
+
+}
+
+#endif
+
+
 /***** Talk only mpode *****/
 void tonMode(){
 
@@ -57,6 +57,579 @@ int DEVNULL::lastByte()
 
 
 
+/***** Timestamped binary record stream *****/
+
+RECSTREAM::RECSTREAM()
+{
+  _output = NULL;
+  _addr = 0;
+  _timestamp = 0;
+  _len = 0;
+}
+
+/***** Start a new record for data from addr *****/
+void RECSTREAM::begin(Stream& output, uint8_t addr)
+{
+  _output = &output;
+  _addr = addr;
+  _timestamp = micros();
+  _len = 0;
+}
+
+/***** Send the remaining data with the final status flags *****/
+void RECSTREAM::end(uint8_t flags)
+{
+  sendRecord(flags & ~REC_MORE);
+}
+
+int RECSTREAM::available()
+{
+  return 0;
+}
+
+int RECSTREAM::peek()
+{
+  return EOF;
+}
+
+int RECSTREAM::read()
+{
+  return EOF;
+}
+
+void RECSTREAM::flush()
+{
+  if (_output) _output->flush();
+}
+
+size_t RECSTREAM::write(const uint8_t data)
+{
+  if (_len == RECBUFSIZE) sendRecord(REC_MORE);
+  _buf[_len++] = data;
+  return 1;
+}
+
+void RECSTREAM::sendRecord(uint8_t flags)
+{
+  uint8_t hdr[8];
+
+  if (_output == NULL) return;
+  hdr[0] = REC_SYNC;
+  hdr[1] = _addr;
+  hdr[2] = _timestamp & 0xFF;
+  hdr[3] = (_timestamp >> 8) & 0xFF;
+  hdr[4] = (_timestamp >> 16) & 0xFF;
+  hdr[5] = (_timestamp >> 24) & 0xFF;
+  hdr[6] = flags;
+  hdr[7] = _len;
+  _output->write(hdr, 8);
+  _output->write(_buf, _len);
+  _len = 0;
+}
+
+
+
+/***** Numeric conversion stream *****/
+#ifdef USE_NUMCONV
+
+#define NUM_IDLE 0        // Between fields
+#define NUM_INT  1        // Integer part
+#define NUM_FRAC 2        // Fractional part
+#define NUM_EXP  3        // Exponent
+#define NUM_SKIP 4        // Trailing characters after the number
+
+NUMSTREAM::NUMSTREAM()
+{
+  _output = NULL;
+  _format = NUM_FLOAT32;
+  reset();
+}
+
+void NUMSTREAM::begin(Stream& output, uint8_t format)
+{
+  _output = &output;
+  _format = format;
+  reset();
+}
+
+/***** Send any number still being parsed *****/
+void NUMSTREAM::end()
+{
+  if (_state != NUM_IDLE) sendNumber();
+  reset();
+}
+
+int NUMSTREAM::available()
+{
+  return 0;
+}
+
+int NUMSTREAM::peek()
+{
+  return EOF;
+}
+
+int NUMSTREAM::read()
+{
+  return EOF;
+}
+
+void NUMSTREAM::flush()
+{
+  if (_output) _output->flush();
+}
+
+void NUMSTREAM::reset()
+{
+  _mant = 0;
+  _exp10 = 0;
+  _expval = 0;
+  _digits = 0;
+  _state = NUM_IDLE;
+  _neg = false;
+  _expneg = false;
+  _valid = false;
+  _bad = false;
+  _lost = false;
+}
+
+size_t NUMSTREAM::write(const uint8_t data)
+{
+  // Field separator
+  if ( (data == ',') || (data == ';') || (data < 0x20) ) {
+    if (_state != NUM_IDLE) sendNumber();
+    reset();
+    return 1;
+  }
+
+  // Ignore white space between fields
+  if (data == ' ') {
+    if (_state != NUM_IDLE) _state = NUM_SKIP;
+    return 1;
+  }
+
+  if (_state == NUM_IDLE) {
+    _state = NUM_INT;
+    if (data == '+') return 1;
+    if (data == '-') {
+      _neg = true;
+      return 1;
+    }
+  }
+
+  if ( (data >= '0') && (data <= '9') ) {
+    if (_state == NUM_EXP) {
+      if (_expval < 1000) _expval = (_expval * 10) + (data - '0');
+      _valid = true;
+    }else if (_state == NUM_SKIP) {
+      _bad = true;
+    }else{
+      // Keep up to 19 significant digits (fits in 64 bits)
+      if ( (_digits < 19) && ((_mant > 0) || (data != '0')) ) {
+        _mant = (_mant * 10) + (data - '0');
+        _digits++;
+        if (_state == NUM_FRAC) _exp10--;
+      }else if (_digits >= 19) {
+        // Digits beyond 19 only scale the integer part
+        if (_state == NUM_INT) _exp10++;
+        if (data != '0') _lost = true;
+      }else if ( (_digits == 0) && (_state == NUM_FRAC) ) {
+        _exp10--;
+      }
+      _valid = true;
+    }
+    return 1;
+  }
+
+  if ( (data == '.') && (_state == NUM_INT) ) {
+    _state = NUM_FRAC;
+    return 1;
+  }
+
+  if ( ((data == 'E') || (data == 'e')) && _valid && ((_state == NUM_INT) || (_state == NUM_FRAC)) ) {
+    _state = NUM_EXP;
+    _valid = false;   // Exponent needs at least one digit
+    return 1;
+  }
+
+  if ( (_state == NUM_EXP) && (_expval == 0) && !_valid && ((data == '+') || (data == '-')) ) {
+    _expneg = (data == '-');
+    return 1;
+  }
+
+  _bad = true;
+  return 1;
+}
+
+
+/***** Convert the parsed number and send it *****/
+/*
+ * The value is held as a 128-bit mantissa m[0..3] (m[3] most
+ * significant) normalised so that bit 127 is set, scaled by a power of
+ * two. It is multiplied or divided by up to 10^13 at a time (5^13 and
+ * a power of two) and the bits shifted out are truncated, noting in
+ * lost that the result is below the true value. When nothing has been
+ * lost, the value is exact and ties round to even. Otherwise it is
+ * less than 2^-118 below the true value, so a number of up to 19
+ * digits is rounded correctly unless it lies even closer than that to
+ * halfway between two values. Values below the smallest normalised
+ * number are sent as subnormals.
+ */
+void NUMSTREAM::sendNumber()
+{
+  const uint8_t pbits = (_format == NUM_FLOAT64) ? 53 : 24;      // Mantissa bits
+  const int16_t bias = (_format == NUM_FLOAT64) ? 1023 : 127;    // Exponent bias
+  const int16_t emax = (_format == NUM_FLOAT64) ? 2047 : 255;    // Maximum exponent
+  const uint8_t nbytes = (_format == NUM_FLOAT64) ? 8 : 4;
+  uint32_t m[4];
+  uint32_t d;
+  uint32_t x;
+  uint64_t t;
+  uint64_t q = 0;
+  uint64_t bits = 0;
+  uint8_t k;
+  uint8_t s;
+  uint8_t i;
+  int16_t e10 = _exp10 + (_expneg ? -_expval : _expval);
+  int16_t e2 = 63;
+  int16_t drop;
+  bool lost = _lost;
+  bool half;
+  bool below = false;
+
+  if (_output == NULL) return;
+
+  if (_bad || !_valid) {
+    // Not a number - send quiet NaN
+    bits = (uint64_t)emax << (pbits - 1);
+    bits |= (uint64_t)1 << (pbits - 2);
+  }else if ( (_mant == 0) || (e10 < -400) ) {
+    // Zero (also underflow)
+    bits = 0;
+  }else if (e10 > 400) {
+    // Overflow - infinity
+    bits = (uint64_t)emax << (pbits - 1);
+  }else{
+    // Normalise
+    t = _mant;
+    while ((t & 0x8000000000000000ULL) == 0) {
+      t <<= 1;
+      e2--;
+    }
+    m[3] = t >> 32;
+    m[2] = t & 0xFFFFFFFFUL;
+    m[1] = 0;
+    m[0] = 0;
+    // Apply decimal exponent
+    while (e10 > 0) {
+      // m * 10^k = m * 5^k * 2^k
+      k = (e10 > 13) ? 13 : e10;
+      for (d = 1, i = 0; i < k; i++) d *= 5;
+      x = 0;
+      for (i = 0; i < 4; i++) {
+        t = ((uint64_t)m[i] * d) + x;
+        m[i] = t & 0xFFFFFFFFUL;
+        x = t >> 32;
+      }
+      // Shift the overflow word back in
+      for (s = 0; (x >> s) > 0; s++);
+      if (m[0] & ((1UL << s) - 1)) lost = true;
+      for (i = 0; i < 3; i++) m[i] = (m[i] >> s) | (m[i + 1] << (32 - s));
+      m[3] = (m[3] >> s) | (x << (32 - s));
+      e2 += k + s;
+      e10 -= k;
+    }
+    while (e10 < 0) {
+      // m / 10^k = (m / 5^k) / 2^k - long division with one word below m
+      k = (e10 < -13) ? 13 : -e10;
+      for (d = 1, i = 0; i < k; i++) d *= 5;
+      x = 0;
+      for (i = 4; i > 0; i--) {
+        t = ((uint64_t)x << 32) | m[i - 1];
+        m[i - 1] = t / d;
+        x = t % d;
+      }
+      t = (uint64_t)x << 32;
+      x = t / d;
+      if (t % d) lost = true;
+      // Shift the word below back in
+      for (s = 0; (m[3] & (0x80000000UL >> s)) == 0; s++);
+      if (s) {
+        if (x & ((0xFFFFFFFFUL >> s))) lost = true;
+        for (i = 3; i > 0; i--) m[i] = (m[i] << s) | (m[i - 1] >> (32 - s));
+        m[0] = (m[0] << s) | (x >> (32 - s));
+      }else if (x) {
+        lost = true;
+      }
+      e2 -= k + s;
+      e10 += k;
+    }
+    // Number of bits below the last mantissa bit (more when subnormal)
+    e2 += bias;
+    drop = 128 - pbits;
+    if (e2 < 1) drop += 1 - e2;
+    if (e2 >= emax) {
+      bits = (uint64_t)emax << (pbits - 1);
+    }else if (drop <= 128) {
+      for (i = 127; i >= drop; i--) q = (q << 1) | ((m[i >> 5] >> (i & 31)) & 1);
+      half = (m[(drop - 1) >> 5] >> ((drop - 1) & 31)) & 1;
+      for (i = 0; i < drop - 1; i++) {
+        if ((m[i >> 5] >> (i & 31)) & 1) below = true;
+      }
+      // Round to nearest even
+      if ( half && (below || lost || (q & 1)) ) q++;
+      // A carry out of the mantissa moves into the exponent
+      bits = q;
+      if (e2 > 1) bits += (uint64_t)(e2 - 1) << (pbits - 1);
+      if ((bits >> (pbits - 1)) >= (uint64_t)emax) bits = (uint64_t)emax << (pbits - 1);
+    }
+    // Values below half the smallest subnormal are sent as zero
+  }
+
+  if (_neg) bits |= (uint64_t)1 << ((nbytes * 8) - 1);
+
+  for (i = 0; i < nbytes; i++) {
+    _output->write((uint8_t)(bits & 0xFF));
+    bits >>= 8;
+  }
+}
+
+#endif
+
+
+
+/***** Compression stream *****/
+#ifdef USE_COMPRESSION
+
+#define ZWIN(p) _win[(p) & (ZWINSIZE - 1)]
+
+ZSTREAM::ZSTREAM()
+{
+  _output = NULL;
+  _pos = 0;
+  _mdist = 0;
+  _mlen = 0;
+  _lit = 0;
+}
+
+/***** Start a new frame *****/
+void ZSTREAM::begin(Stream& output)
+{
+  _output = &output;
+  _pos = 0;
+  _mlen = 0;
+  _lit = 0;
+  memset(_hash, 0xFF, sizeof(_hash));
+}
+
+/***** Send pending data and terminate the frame *****/
+void ZSTREAM::end()
+{
+  if (_output == NULL) return;
+  if (_mlen) sendMatch();
+  if (_lit) sendLiterals(_lit);
+  _output->write((uint8_t)ZEND);
+}
+
+int ZSTREAM::available()
+{
+  return 0;
+}
+
+int ZSTREAM::peek()
+{
+  return EOF;
+}
+
+int ZSTREAM::read()
+{
+  return EOF;
+}
+
+void ZSTREAM::flush()
+{
+  if (_output) _output->flush();
+}
+
+size_t ZSTREAM::write(const uint8_t data)
+{
+  uint16_t cand;
+  uint16_t dist;
+  uint8_t h;
+
+  if (_output == NULL) return 0;
+
+  // Extend the current match?
+  if (_mlen) {
+    if ( (_mlen < ZMAXMATCH) && (ZWIN(_pos - _mdist) == data) ) {
+      ZWIN(_pos) = data;
+      _pos++;
+      _mlen++;
+      return 1;
+    }
+    sendMatch();
+  }
+
+  ZWIN(_pos) = data;
+  _pos++;
+  _lit++;
+
+  if (_pos >= ZMINMATCH) {
+    // Look up and record the position of the last three bytes
+    h = ((ZWIN(_pos-3) << 4) ^ (ZWIN(_pos-2) << 2) ^ ZWIN(_pos-1)) & (ZHASHSIZE - 1);
+    cand = _hash[h];
+    _hash[h] = _pos - 3;
+    dist = (_pos - 3) - cand;
+    // Start a match if all three bytes are pending literals and match the candidate.
+    // Beyond ZWINSIZE - ZMINMATCH the new bytes have overwritten part of the candidate.
+    if ( (_lit >= ZMINMATCH) && (cand != 0xFFFF) && (dist > 0) && (dist <= ZWINSIZE - ZMINMATCH) && (dist <= (_pos - 3))
+         && (ZWIN(cand) == ZWIN(_pos-3)) && (ZWIN(cand+1) == ZWIN(_pos-2)) && (ZWIN(cand+2) == ZWIN(_pos-1)) ) {
+      if (_lit > ZMINMATCH) sendLiterals(_lit - ZMINMATCH);
+      _lit = 0;
+      _mlen = ZMINMATCH;
+      _mdist = dist;
+      return 1;
+    }
+  }
+
+  if (_lit == ZMAXLIT) sendLiterals(_lit);
+  return 1;
+}
+
+/***** Send the oldest count pending literals *****/
+void ZSTREAM::sendLiterals(uint8_t count)
+{
+  uint16_t start = _pos - _lit;
+
+  _output->write((uint8_t)(count - 1));
+  for (uint8_t i = 0; i < count; i++) {
+    _output->write(ZWIN(start + i));
+  }
+  _lit = _lit - count;
+}
+
+/***** Send the current match *****/
+void ZSTREAM::sendMatch()
+{
+  _output->write((uint8_t)(0x80 | (_mlen - ZMINMATCH)));
+  _output->write((uint8_t)(_mdist - 1));
+  _mlen = 0;
+}
+
+#endif
+
+
+
+/***** Tail stream *****/
+#ifdef USE_PROBE
+
+void TAILSTREAM::begin()
+{
+  memset(tail, 0, sizeof(tail));
+  count = 0;
+}
+
+int TAILSTREAM::available()
+{
+  return 0;
+}
+
+int TAILSTREAM::peek()
+{
+  return EOF;
+}
+
+int TAILSTREAM::read()
+{
+  return EOF;
+}
+
+void TAILSTREAM::flush()
+{
+}
+
+size_t TAILSTREAM::write(const uint8_t data)
+{
+  tail[2] = tail[1];
+  tail[1] = tail[0];
+  tail[0] = data;
+  if (count < 0xFFFF) count++;
+  return 1;
+}
+
+#endif
+
+
+
+/***** Query stream *****/
+#ifdef USE_RESPONDER
+
+void QRYSTREAM::begin(Stream& output, void (*first)())
+{
+  _output = &output;
+  _first = first;
+  _len = 0;
+  _passed = false;
+}
+
+bool QRYSTREAM::held()
+{
+  return !_passed;
+}
+
+void QRYSTREAM::release()
+{
+  if (_passed) return;
+  _passed = true;
+  if (_first) _first();
+  _output->write((const uint8_t *)_buf, _len);
+}
+
+void QRYSTREAM::query(char *qry)
+{
+  uint8_t len = _len;
+  while ( len && ((_buf[len-1] == '\r') || (_buf[len-1] == '\n') || (_buf[len-1] == ' ')) ) len--;
+  // Too long to be in the table
+  if (len > RESP_QLEN) len = 0;
+  memcpy(qry, _buf, len);
+  qry[len] = '\0';
+}
+
+int QRYSTREAM::available()
+{
+  return 0;
+}
+
+int QRYSTREAM::peek()
+{
+  return EOF;
+}
+
+int QRYSTREAM::read()
+{
+  return EOF;
+}
+
+void QRYSTREAM::flush()
+{
+}
+
+size_t QRYSTREAM::write(const uint8_t data)
+{
+  if (!_passed) {
+    if (_len < QRYBUFSIZE) {
+      _buf[_len++] = data;
+      return 1;
+    }
+    release();
+  }
+  return _output->write(data);
+}
+
+#endif
+
+
+
 /***************************************/
 /***** Serial Port implementations *****/
 /***************************************/
@@ -147,6 +720,49 @@ int DEVNULL::lastByte()
 
 
 
+/*************************/ 
+/***** TRACE BUFFER *****/
+/*************************/
+
+#ifdef TRACE_ENABLE
+
+  traceRec traceBuf[TRACE_RECORDS];
+  uint8_t traceHead = 0;
+  uint8_t traceCount = 0;
+
+  /***** Send the trace buffer, oldest record first *****/
+  /*
+   * Number of records (1 byte) followed by 8 byte records:
+   * id (2 bytes), arg1, arg2, timestamp (4 bytes), low byte first
+   */
+  void traceDump(Stream& output) {
+    uint8_t cnt = traceCount;
+    uint8_t i = (traceHead - cnt) & (TRACE_RECORDS - 1);
+    output.write(cnt);
+    while (cnt) {
+      output.write((uint8_t)traceBuf[i].id);
+      output.write((uint8_t)(traceBuf[i].id >> 8));
+      output.write(traceBuf[i].arg1);
+      output.write(traceBuf[i].arg2);
+      output.write((uint8_t)traceBuf[i].time);
+      output.write((uint8_t)(traceBuf[i].time >> 8));
+      output.write((uint8_t)(traceBuf[i].time >> 16));
+      output.write((uint8_t)(traceBuf[i].time >> 24));
+      i = (i + 1) & (TRACE_RECORDS - 1);
+      cnt--;
+    }
+  }
+
+  void traceClear() {
+    traceHead = 0;
+    traceCount = 0;
+  }
+
+#endif  // TRACE_ENABLE
+
+
+
+
 /**************************/ 
 /***** BLUETOOTH PORT *****/
 /**************************/
@@ -34,6 +34,216 @@ private:
 };
 
 
+/***** Timestamped binary record stream *****
+ * Collects data written to it and passes it on to the output stream
+ * wrapped in records of the following format:
+ * 
+ *   RS | addr | timestamp (4 bytes) | flags | length | data
+ * 
+ * RS is the ASCII record separator (0x1E). The timestamp is the value
+ * of micros() when begin() was called and is sent low byte first.
+ * Data longer than RECBUFSIZE is split into several records that carry
+ * the same address and timestamp, all but the last having REC_MORE set.
+ */
+
+#define RECBUFSIZE 32     // Maximum data length of a record
+#define REC_SYNC 0x1E     // Start of record (ASCII RS)
+#define REC_MORE 0x80     // Flag: data continues in the next record
+
+class RECSTREAM : public Stream
+{
+public:
+  RECSTREAM();
+
+  void   begin(Stream& output, uint8_t addr);
+  void   end(uint8_t flags);
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+
+private:
+  void     sendRecord(uint8_t flags);
+
+  Stream * _output;
+  uint8_t  _addr;
+  uint32_t _timestamp;
+  uint8_t  _buf[RECBUFSIZE];
+  uint8_t  _len;
+};
+
+
+/***** Numeric conversion stream *****
+ * Parses NR1, NR2 and NR3 numbers (e.g. 123, -1.5, +1.23456789E+00)
+ * written to it and passes each on to the output stream as an IEEE-754
+ * single (4 bytes) or double (8 bytes) precision value, low byte first.
+ * Numbers are separated by commas, semicolons or control characters
+ * (CR, LF). Fields that are not valid numbers are sent as NaN.
+ * 
+ * Conversion uses integer arithmetic only, so double precision values
+ * are available on AVR boards where double is the same as float.
+ */
+#ifdef USE_NUMCONV
+
+#define NUM_FLOAT32 1     // Single precision output
+#define NUM_FLOAT64 2     // Double precision output
+
+class NUMSTREAM : public Stream
+{
+public:
+  NUMSTREAM();
+
+  void   begin(Stream& output, uint8_t format);
+  void   end();
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+
+private:
+  void     reset();
+  void     sendNumber();
+
+  Stream * _output;
+  uint8_t  _format;
+  uint64_t _mant;         // Significant digits
+  int16_t  _exp10;        // Decimal exponent applied to _mant
+  int16_t  _expval;       // Value of exponent field
+  uint8_t  _digits;       // Number of significant digits in _mant
+  uint8_t  _state;        // Parser state
+  bool     _neg;          // Number is negative
+  bool     _expneg;       // Exponent is negative
+  bool     _valid;        // At least one mantissa digit seen
+  bool     _bad;          // Field contains invalid characters
+  bool     _lost;         // Non-zero digits beyond the 19 kept
+};
+
+#endif
+
+
+/***** Compression stream *****
+ * Compresses data written to it using a simple LZ77 scheme and passes
+ * it on to the output stream as a sequence of tokens:
+ * 
+ *   0x00-0x7E  n+1 literal bytes follow
+ *   0x7F       end of frame (decoder clears its history)
+ *   0x80-0xFF  copy (n & 0x7F) + 3 bytes starting d bytes back, where
+ *              d-1 is given by the following byte
+ * 
+ * Each call to begin() starts a new frame which end() terminates, so
+ * the host can decompress incrementally, token by token. Matches are
+ * found through a hash of the last three bytes, so the cost per byte
+ * is constant.
+ */
+#ifdef USE_COMPRESSION
+
+#define ZWINSIZE 256      // History size (offsets are coded in one byte)
+#define ZHASHSIZE 64      // Number of hash table entries
+#define ZMINMATCH 3       // Shortest match
+#define ZMAXMATCH 130     // Longest match
+#define ZMAXLIT 127       // Longest run of literals
+#define ZEND 0x7F         // End of frame token
+
+class ZSTREAM : public Stream
+{
+public:
+  ZSTREAM();
+
+  void   begin(Stream& output);
+  void   end();
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+
+private:
+  void     sendLiterals(uint8_t count);
+  void     sendMatch();
+
+  Stream * _output;
+  uint8_t  _win[ZWINSIZE];      // History (ring buffer)
+  uint16_t _hash[ZHASHSIZE];    // Last position of each 3-byte hash
+  uint16_t _pos;                // Number of bytes written in this frame
+  uint16_t _mdist;              // Distance of current match
+  uint8_t  _mlen;               // Length of current match (0 = none)
+  uint8_t  _lit;                // Number of pending literals
+};
+
+#endif
+
+
+/***** Tail stream *****
+ * Counts the bytes written to it and keeps the last three
+ * (tail[0] is the most recent)
+ */
+#ifdef USE_PROBE
+
+class TAILSTREAM : public Stream
+{
+public:
+  void   begin();
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+
+  uint8_t  tail[3];
+  uint16_t count;
+};
+
+#endif
+
+
+/***** Query stream *****
+ * Holds back data written to it as long as it fits in the query buffer
+ * (a query of up to RESP_QLEN characters and its CR/LF terminator).
+ * Once more arrives, or release() is called, the callback passed to
+ * begin() is run and the held data and everything after it is passed
+ * on to the output stream. query() copies the held data without its
+ * trailing terminator.
+ */
+#ifdef USE_RESPONDER
+
+#define QRYBUFSIZE (RESP_QLEN + 2)
+
+class QRYSTREAM : public Stream
+{
+public:
+  void   begin(Stream& output, void (*first)());
+  bool   held();
+  void   release();
+  void   query(char *qry);
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+
+private:
+  Stream * _output;
+  void     (*_first)();
+  char     _buf[QRYBUFSIZE];
+  uint8_t  _len;
+  bool     _passed;       // Data is being passed on to the output stream
+};
+
+#endif
+
+
 /*
  * Serial Port definition
  */
@@ -113,6 +323,55 @@ private:
 #endif  // DEBUG_ENABLE
 
 
+
+#ifdef TRACE_ENABLE
+
+  /*
+   * The id of a trace point holds the file number in bits 13-15 and the
+   * line number in bits 0-12. Files using TRACE() must define TRACE_FILE
+   * before including this header (AR488.ino = 0, AR488_GPIBbus.cpp = 1)
+   */
+  struct traceRec {
+    uint16_t id;      // Trace point (file and line)
+    uint8_t arg1;     // Values recorded
+    uint8_t arg2;
+    uint32_t time;    // Timestamp (micros)
+  };
+
+  // The record count is a uint8_t and is sent as one byte by traceDump()
+  static_assert( (TRACE_RECORDS <= 128) && ((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0),
+                 "TRACE_RECORDS must be a power of 2 from 1 to 128" );
+
+  extern traceRec traceBuf[TRACE_RECORDS];
+  extern uint8_t traceHead;
+  extern uint8_t traceCount;
+
+  inline void traceAdd(uint16_t id, uint8_t arg1, uint8_t arg2) {
+    traceRec *rec = &traceBuf[traceHead];
+    rec->time = micros();
+    rec->id = id;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    traceHead = (traceHead + 1) & (TRACE_RECORDS - 1);
+    if (traceCount < TRACE_RECORDS) traceCount++;
+  }
+
+  void traceDump(Stream& output);
+  void traceClear();
+
+  #ifndef TRACE_FILE
+    #define TRACE_FILE 0
+  #endif
+
+  #define TRACE(arg1,arg2) traceAdd(((TRACE_FILE) << 13) | (__LINE__ & 0x1FFF), (arg1), (arg2))
+
+#else
+
+  #define TRACE(arg1,arg2)
+
+#endif  // TRACE_ENABLE
+
+
 /***** BlueTooth Functions *****/
 
 #ifdef AR_SERIAL_BT_ENABLE
@@ -102,6 +102,18 @@
   #define DB_SERIAL_SPEED 115200
 #endif
 
+/***** Trace buffer *****/
+/*
+ * Trace points record an event id, two values and a timestamp in a RAM
+ * ring buffer that is read with the ++trace command. Unlike the debug
+ * port, this does not disturb bus timing.
+ */
+//#define TRACE_ENABLE
+#ifdef TRACE_ENABLE
+  // Number of trace records held (power of 2 up to 128, 8 bytes each)
+  #define TRACE_RECORDS 32
+#endif
+
 /***** Configure SoftwareSerial Port *****/
 /*
  * Configure the SoftwareSerial TX/RX pins and baud rate here
@@ -146,6 +158,8 @@
 #ifdef AR488_MCP23017
   #define MCP_ADDRESS   1
   #define MCP_INTERRUPT 3
+  #define MCP_I2C_CLOCK 400000  // I2C clock in Hz (100000, 400000 or 1000000 with strong pullups)
+  #define MCP_REFRESH_US 1000   // Re-read port A at least this often (microseconds) even without INTA
 #endif
 
 
@@ -220,6 +234,52 @@
 //#define SAY_HELLO
 
 
+/***** Numeric conversion of readings *****/
+/*
+ * Uncomment to allow numeric readings to be returned to the host as
+ * IEEE-754 binary values (++numfmt). Uses 64-bit integer arithmetic
+ * which adds around 2kB to the size of the sketch.
+ */
+//#define USE_NUMCONV
+
+
+/***** Compression of received data *****/
+/*
+ * Uncomment to allow data received from the GPIB bus to be compressed
+ * before it is sent to the host (++compress). Uses around 400 bytes of
+ * RAM, so is best suited to boards such as the Mega 2560.
+ */
+//#define USE_COMPRESSION
+
+
+/***** Bus statistics *****/
+/*
+ * Uncomment to collect handshake timing histograms and per-address
+ * transfer counts (++stats). Uses around 300 bytes of RAM.
+ */
+//#define USE_STATS
+
+
+/***** Main loop profiler *****/
+/*
+ * Uncomment to measure the time taken by the main loop and by each
+ * section of it (++perf).
+ */
+//#define USE_PERF
+
+
+/***** HS488 high speed handshake *****/
+/*
+ * Uncomment to allow the non-interlocked HS488 handshake to be
+ * enabled with ++hs488. Not available with the MCP23S17 and
+ * MCP23017 port expanders.
+ */
+//#define USE_HS488
+#if defined(AR488_MCP23S17) || defined(AR488_MCP23017)
+  #undef USE_HS488
+#endif
+
+
 
 
 /***** DEBUG LEVEL OPTIONS *****/
@@ -309,6 +369,9 @@
  * USE_MACROS must be enabled to enable the macro feature including 
  * MACRO_0 (the startup macro). RUN_STARTUP must be uncommented to 
  * run the startup macro when the interface boots up
+ * 
+ * Macros can also be defined at runtime with ++macro def/rec. These
+ * are stored in EEPROM and replace compiled-in macros of the same number.
  */
 //#define USE_MACROS    // Enable the macro feature
 //#define RUN_STARTUP   // Run MACRO_0 (the startup macro)
@@ -373,6 +436,134 @@ M3\n\
 /********************************/
 
 
+/***********************************/
+/***** AR488 SEQUENCER SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to enable the command sequencer (++seq). A sequence of
+ * send, read, trigger, serial poll, SRQ wait, delay and loop steps is
+ * held in RAM and run by the interface without intervention from the
+ * host. SEQ_SIZE sets the size of the program buffer in bytes. Where
+ * the board has an EEPROM the sequence can be saved and re-loaded.
+ */
+//#define USE_SEQUENCER     // Enable the command sequencer
+#define SEQ_SIZE 96         // Size of sequence program buffer
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 SEQUENCER SECTION *****/
+/***********************************/
+
+
+/********************************/
+/***** AR488 POLLER SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to enable timed acquisition (++poll). Each entry holds an
+ * instrument address, a query and a period. The schedule is kept by
+ * Timer1 on AVR boards so that readings do not drift when reads take
+ * longer than expected. POLL_ENTRIES sets the number of entries (8 at
+ * most) and POLL_QLEN the maximum length of a query.
+ */
+//#define USE_POLLER        // Enable timed acquisition
+#define POLL_ENTRIES 6      // Number of poll entries (1-8)
+#define POLL_QLEN 20        // Maximum query length (including terminator)
+
+/***** ^^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 POLLER SECTION *****/
+/********************************/
+
+
+/*******************************/
+/***** AR488 PROBE SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to enable instrument probing (++probe). The interface sends
+ * a query to an instrument, measures how it responds and keeps a read
+ * profile (terminator and inter-byte timeout) for its address. The
+ * profile is then used whenever that instrument is read. PROBE_ENTRIES
+ * sets the number of profiles held.
+ */
+//#define USE_PROBE         // Enable instrument probing
+#define PROBE_ENTRIES 8     // Number of instrument profiles
+
+/***** ^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 PROBE SECTION *****/
+/*******************************/
+
+
+/**********************************/
+/***** AR488 ANALYZER SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to enable the bus analyzer (++capture). In device mode the
+ * interface listens to all bus traffic and sends each byte to the host
+ * in a binary record with a timestamp and the state of the ATN, EOI,
+ * SRQ, REN and IFC lines. ANA_RECORDS sets the number of records that
+ * are buffered while the host is being sent data (6 bytes each).
+ */
+//#define USE_ANALYZER      // Enable the bus analyzer
+#define ANA_RECORDS 32      // Number of records in the capture buffer
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 ANALYZER SECTION *****/
+/**********************************/
+
+
+/*************************************/
+/***** AR488 DEVICE FIFO SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to queue data from the host in an output FIFO in device
+ * mode (++txfifo). When the controller addresses the interface to talk,
+ * the FIFO is sent up to the end of the next message, waiting for the
+ * host if the message is not yet complete. A line ended by CR or LF
+ * ends a message. TXFIFO_SIZE must be a power of 2. XOFF is sent to the
+ * host when fewer than TXFIFO_XOFF bytes are free and XON once half of
+ * the FIFO is free again (0 = no flow control).
+ */
+//#define USE_TXFIFO        // Enable the device mode output FIFO
+#define TXFIFO_SIZE 512     // Size of the output FIFO in bytes
+#define TXFIFO_XOFF 160     // Send XOFF when fewer bytes than this are free
+
+/*
+ * DEV_ADDRS sets the number of addresses the interface can answer to
+ * in device mode (++devaddr), each with its own output FIFO and status
+ * byte. Each address uses TXFIFO_SIZE bytes of RAM for its FIFO.
+ */
+#define DEV_ADDRS 1         // Addresses in device mode (1 = the ++addr address only)
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 DEVICE FIFO SECTION *****/
+/*************************************/
+
+
+/***********************************/
+/***** AR488 RESPONDER SECTION *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvv *****/
+
+/*
+ * Uncomment to answer common queries in device mode from a table set
+ * by the host (++resp). A query received from the controller that
+ * matches an entry is not passed on to the host. Instead, the response
+ * is sent the next time the interface is addressed to talk. Queries
+ * are limited to RESP_QLEN characters and responses to RESP_RLEN. Each
+ * entry uses RESP_QLEN + RESP_RLEN + 2 bytes of RAM.
+ */
+//#define USE_RESPONDER     // Enable cached replies in device mode
+#define RESP_ENTRIES 4      // Number of query/response pairs
+#define RESP_QLEN 15        // Maximum length of a query
+#define RESP_RLEN 47        // Maximum length of a response
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** AR488 RESPONDER SECTION *****/
+/***********************************/
+
+
 /******************************************/
 /***** !!! DO NOT EDIT BELOW HERE !!! *****/
 /******vvvvvvvvvvvvvvvvvvvvvvvvvvvvvv******/
@@ -11,6 +11,7 @@
 
 /***** Forward declarations of internal functions *****/
 uint16_t getCRC16(uint8_t bytes[], uint16_t bsize);
+uint16_t addCRC16(uint16_t crc, uint8_t db);
 unsigned long int getCRC32(uint8_t bytes[], uint16_t bsize);
 
 
@@ -118,6 +119,371 @@ bool isEepromClear(){
   }
 }
 
+
+#ifdef E2END
+
+/***** Named configuration slot functions *****/
+
+/***** EEPROM address of a frame *****/
+uint16_t epFrameAddr(uint8_t slot, uint8_t frame) {
+  return EESLOTSTART + (slot * EESLOTSIZE) + (frame * EEFRAMESIZE);
+}
+
+
+/***** Does the frame carry the given slot name? *****/
+bool epFrameNameIs(uint16_t addr, const char *name) {
+  char c;
+  for (uint8_t i=0; i<EESLOT_NAMELEN; i++) {
+    c = EEPROM.read(addr+i);
+    if (c != name[i]) return false;
+    if (c == '\0') return true;
+  }
+  return true;
+}
+
+
+/***** Check the CRC of a frame *****/
+/*
+ * The CRC covers the name, sequence number and config data
+ * Frames with a blank (0xFF) or deleted (0x00) name are not valid
+ */
+bool epFrameValid(uint16_t addr, uint16_t cfgsize) {
+  uint16_t crc1;
+  uint16_t crc2 = 0xFFFF;
+  uint16_t i;
+  uint8_t c = EEPROM.read(addr);
+
+  if (c==0x00 || c==0xFF) return false;
+  for (i=0; i<EESLOT_NAMELEN+2; i++) {
+    crc2 = addCRC16(crc2, EEPROM.read(addr+i));
+  }
+  for (i=0; i<cfgsize; i++) {
+    crc2 = addCRC16(crc2, EEPROM.read(addr+EEFRAMEHDR+i));
+  }
+  EEPROM.get(addr+EESLOT_NAMELEN+2, crc1);
+  return (crc1==crc2);
+}
+
+
+/***** Find the current (newest valid) frame in a slot *****/
+/*
+ * Returns the frame number and sets seq to its sequence number
+ * Returns EEFRAMES if the slot holds no valid frame
+ */
+uint8_t epSlotCurrent(uint8_t slot, uint16_t cfgsize, uint16_t &seq) {
+  uint8_t cur = EEFRAMES;
+  uint16_t addr;
+  uint16_t fseq;
+
+  for (uint8_t f=0; f<EEFRAMES; f++) {
+    addr = epFrameAddr(slot, f);
+    if (!epFrameValid(addr, cfgsize)) continue;
+    EEPROM.get(addr+EESLOT_NAMELEN, fseq);
+    // Sequence numbers wrap so compare the difference
+    if ( (cur==EEFRAMES) || ((int16_t)(fseq-seq) > 0) ) {
+      cur = f;
+      seq = fseq;
+    }
+  }
+  return cur;
+}
+
+
+/***** Find the slot holding a named configuration *****/
+/*
+ * Returns the slot number or EESLOTS if not found. When create is
+ * true and the name is not found, the first empty slot is returned.
+ * Slot 0 is reserved for the startup configuration.
+ */
+uint8_t epSlotFind(const char *name, uint16_t cfgsize, bool create) {
+  uint8_t empty = EESLOTS;
+  uint16_t seq;
+  bool named;
+
+  if (strcmp(name, EESLOT_STARTUP) == 0) return 0;
+
+  for (uint8_t s=1; s<EESLOTS; s++) {
+    // Compare names first - much cheaper than checking the CRC
+    named = false;
+    for (uint8_t f=0; f<EEFRAMES; f++) {
+      if (epFrameNameIs(epFrameAddr(s, f), name)) named = true;
+    }
+    if (named) {
+      if (epSlotCurrent(s, cfgsize, seq) < EEFRAMES) return s;
+    }
+    if (create && (empty==EESLOTS)) {
+      if (epSlotCurrent(s, cfgsize, seq) == EEFRAMES) empty = s;
+    }
+  }
+  return create ? empty : EESLOTS;
+}
+
+
+/***** Write a named configuration to its slot *****/
+/*
+ * Writes to the frame following the current one so that repeated
+ * saves rotate through the frames of the slot. Only bytes that differ
+ * from what is already in the frame are written. If the current frame
+ * already holds identical data then nothing is written at all.
+ */
+bool epSlotWrite(const char *name, uint8_t cfgdata[], uint16_t cfgsize) {
+  uint8_t nlen = strlen(name);
+  uint8_t slot;
+  uint8_t f;
+  uint16_t addr;
+  uint16_t seq = 0;
+  uint16_t crc = 0xFFFF;
+  uint16_t i;
+  char c;
+
+  if ( (nlen==0) || (nlen>=EESLOT_NAMELEN) || (cfgsize>AR_CFG_SIZE) ) return false;
+
+  slot = epSlotFind(name, cfgsize, true);
+  if (slot >= EESLOTS) return false;  // No free slot
+
+  f = epSlotCurrent(slot, cfgsize, seq);
+  if (f < EEFRAMES) {
+    // Unchanged since last save?
+    addr = epFrameAddr(slot, f) + EEFRAMEHDR;
+    for (i=0; i<cfgsize; i++) {
+      if (EEPROM.read(addr+i) != cfgdata[i]) break;
+    }
+    if (i==cfgsize) return true;
+    // Rotate to the next frame
+    f = (f + 1) % EEFRAMES;
+    seq++;
+  }else{
+    f = 0;
+    seq = 0;
+  }
+
+  addr = epFrameAddr(slot, f);
+
+  // Write data
+  for (i=0; i<cfgsize; i++) {
+    EEPROM.update(addr+EEFRAMEHDR+i, cfgdata[i]);
+  }
+  // Write name and sequence number
+  for (i=0; i<EESLOT_NAMELEN; i++) {
+    c = (i<nlen) ? name[i] : '\0';
+    EEPROM.update(addr+i, c);
+    crc = addCRC16(crc, c);
+  }
+  EEPROM.put(addr+EESLOT_NAMELEN, seq);
+  crc = addCRC16(crc, seq & 0xFF);
+  crc = addCRC16(crc, seq >> 8);
+  // Write CRC last - the frame becomes current only once complete
+  for (i=0; i<cfgsize; i++) {
+    crc = addCRC16(crc, cfgdata[i]);
+  }
+  EEPROM.put(addr+EESLOT_NAMELEN+2, crc);
+  return true;
+}
+
+
+/***** Read a named configuration from its slot *****/
+/*
+ * cfgdata is only modified if a valid frame was found
+ */
+bool epSlotRead(const char *name, uint8_t cfgdata[], uint16_t cfgsize) {
+  uint8_t slot;
+  uint8_t f;
+  uint16_t addr;
+  uint16_t seq = 0;
+
+  if (cfgsize>AR_CFG_SIZE) return false;
+
+  slot = epSlotFind(name, cfgsize, false);
+  if (slot >= EESLOTS) return false;
+
+  f = epSlotCurrent(slot, cfgsize, seq);
+  if (f >= EEFRAMES) return false;
+
+  addr = epFrameAddr(slot, f) + EEFRAMEHDR;
+  for (uint16_t i=0; i<cfgsize; i++) {
+    cfgdata[i] = EEPROM.read(addr+i);
+  }
+  return true;
+}
+
+
+/***** Delete a named configuration *****/
+bool epSlotErase(const char *name, uint16_t cfgsize) {
+  uint8_t slot = epSlotFind(name, cfgsize, false);
+
+  if (slot >= EESLOTS) return false;
+  // Mark all frames as deleted
+  for (uint8_t f=0; f<EEFRAMES; f++) {
+    EEPROM.update(epFrameAddr(slot, f), 0x00);
+  }
+  return true;
+}
+
+
+/***** List the names of saved configurations *****/
+void epSlotList(Stream& outputStream, uint16_t cfgsize) {
+  char name[EESLOT_NAMELEN];
+  uint16_t addr;
+  uint16_t seq;
+  uint8_t f;
+
+  for (uint8_t s=0; s<EESLOTS; s++) {
+    f = epSlotCurrent(s, cfgsize, seq);
+    if (f < EEFRAMES) {
+      addr = epFrameAddr(s, f);
+      for (uint8_t i=0; i<EESLOT_NAMELEN; i++) {
+        name[i] = EEPROM.read(addr+i);
+      }
+      name[EESLOT_NAMELEN-1] = '\0';
+      outputStream.print(name);
+      outputStream.print(" ");
+    }
+  }
+  outputStream.println();
+}
+
+#endif  // E2END
+
+
+#if defined(E2END) && (defined(USE_MACROS) || defined(USE_SEQUENCER))
+
+/***** Runtime macro functions *****/
+
+/***** Read the header of the macro record at addr *****/
+/*
+ * Returns false at the end of the macro list. A blank (0xFF) or
+ * invalid macro number, or a length that overruns the macro area,
+ * marks the end of the list.
+ */
+bool epMacroRecord(uint16_t addr, uint8_t &idx, uint16_t &msize) {
+  if ((addr + EEMACROHDR) > EEMACROEND) return false;
+  idx = EEPROM.read(addr);
+  if (idx > EEMACRO_SEQ) return false;
+  EEPROM.get(addr+1, msize);
+  if (msize > (EEMACROEND - addr - EEMACROHDR)) return false;
+  return true;
+}
+
+
+/***** Address of the first free byte in the macro area *****/
+uint16_t epMacroEnd() {
+  uint16_t addr = EEMACROSTART;
+  uint16_t msize;
+  uint8_t idx;
+
+  while (epMacroRecord(addr, idx, msize)) {
+    addr += EEMACROHDR + msize;
+  }
+  return addr;
+}
+
+
+/***** Find a macro *****/
+/*
+ * Sets addr to the start of the macro text and msize to its length
+ */
+bool epMacroFind(uint8_t idx, uint16_t &addr, uint16_t &msize) {
+  uint16_t raddr = EEMACROSTART;
+  uint8_t ridx;
+
+  while (epMacroRecord(raddr, ridx, msize)) {
+    if (ridx == idx) {
+      addr = raddr + EEMACROHDR;
+      return true;
+    }
+    raddr += EEMACROHDR + msize;
+  }
+  return false;
+}
+
+
+/***** Read a character of macro text *****/
+char epMacroChar(uint16_t addr) {
+  return EEPROM.read(addr);
+}
+
+
+/***** Delete a macro *****/
+/*
+ * Following records are moved down to close the gap
+ */
+bool epMacroErase(uint8_t idx) {
+  uint16_t addr;
+  uint16_t msize;
+  uint16_t end;
+  uint16_t i;
+
+  if (!epMacroFind(idx, addr, msize)) return false;
+  end = epMacroEnd();
+  addr = addr - EEMACROHDR;
+  msize = msize + EEMACROHDR;
+  for (i=addr+msize; i<end; i++) {
+    EEPROM.update(i-msize, EEPROM.read(i));
+  }
+  EEPROM.update(end-msize, 0xFF);
+  return true;
+}
+
+
+/***** Append text to a macro *****/
+/*
+ * Creates the macro if it does not exist. Only the last macro in the
+ * list can be extended, which is always the case while recording. The
+ * header is written last so the list stays intact if interrupted.
+ */
+bool epMacroAppend(uint8_t idx, const char *data, uint16_t dsize) {
+  uint16_t addr;
+  uint16_t msize;
+  uint16_t end = epMacroEnd();
+  uint16_t i;
+
+  if (idx > EEMACRO_SEQ) return false;
+
+  if (epMacroFind(idx, addr, msize)) {
+    if ((addr + msize) != end) return false;
+    addr = addr - EEMACROHDR;
+  }else{
+    if ((end + EEMACROHDR) > EEMACROEND) return false;
+    addr = end;
+    msize = 0;
+    end = end + EEMACROHDR;
+  }
+  if (dsize > (EEMACROEND - end)) return false;
+
+  // Write text
+  for (i=0; i<dsize; i++) {
+    EEPROM.update(end+i, data[i]);
+  }
+  // Terminate the list
+  if ((end + dsize) < EEMACROEND) EEPROM.update(end+dsize, 0xFF);
+  // Write header
+  msize = msize + dsize;
+  EEPROM.put(addr+1, msize);
+  EEPROM.update(addr, idx);
+  return true;
+}
+
+
+/***** Define a macro *****/
+/*
+ * Replaces any existing macro with the same number. The existing
+ * macro is kept if there is not enough room for the new one.
+ */
+bool epMacroWrite(uint8_t idx, const char *data, uint16_t dsize) {
+  uint16_t addr;
+  uint16_t msize;
+  uint16_t avail = EEMACROEND - epMacroEnd();
+
+  if (idx > EEMACRO_SEQ) return false;
+  if (epMacroFind(idx, addr, msize)) avail = avail + EEMACROHDR + msize;
+  if ((dsize + EEMACROHDR) > avail) return false;
+
+  epMacroErase(idx);
+  return epMacroAppend(idx, data, dsize);
+}
+
+#endif  // USE_MACROS || USE_SEQUENCER
+
 #endif
 
 /************************************/
@@ -260,13 +626,19 @@ unsigned long int getCRC32(uint8_t bytes[], uint16_t bsize) {
 }
 
 uint16_t getCRC16(uint8_t bytes[], uint16_t bsize){
-  uint8_t x;
   uint16_t crc = 0xFFFF;
 
   for (uint16_t idx=0; idx<bsize; ++idx) {
-    x = crc >> 8 ^ bytes[idx];
-    x ^= x>>4;
-    crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x <<5)) ^ ((uint16_t)x);
+    crc = addCRC16(crc, bytes[idx]);
   }
   return crc;
 }
+
+/***** Add a byte to a running CRC16 *****/
+uint16_t addCRC16(uint16_t crc, uint8_t db){
+  uint8_t x;
+
+  x = crc >> 8 ^ db;
+  x ^= x>>4;
+  return (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x <<5)) ^ ((uint16_t)x);
+}
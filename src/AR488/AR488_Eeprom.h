@@ -26,6 +26,76 @@
 const uint16_t eesize = EESIZE;
 
 
+/*
+ * Named configuration slots:
+ * 
+ * The area between EESLOTSTART and the end of the EEPROM is divided into
+ * slots, each holding one named configuration. Every slot is made up of
+ * EEFRAMES frames which are used in rotation, so that repeated saves of
+ * the same slot are spread across different cells. Each frame holds the
+ * slot name, a sequence number, the configuration data and a CRC. The
+ * frame with the highest sequence number and a valid CRC is the current
+ * one. The CRC is written last, so an interrupted save leaves the
+ * previous frame intact.
+ * 
+ * Slot 0 is reserved for the startup configuration (++savecfg).
+ */
+#ifdef E2END
+
+#define EESLOTSTART 128               // Start of slot area (leaves room for legacy config at EESTART)
+#if defined(USE_MACROS) || defined(USE_SEQUENCER)
+  #define EESLOTEND EEMACROSTART      // Slots end where the macro area begins
+#else
+  #define EESLOTEND (E2END + 1)       // End of slot area
+#endif
+#define EESLOT_NAMELEN 10             // Slot name length (max 9 characters + null terminator)
+#define EESLOT_STARTUP "startup"      // Name of the startup configuration slot
+
+#if (E2END + 1) >= 4096
+  #define EEFRAMES 4                  // Frames per slot (ATmega2560/1284)
+#else
+  #define EEFRAMES 2                  // Frames per slot (smaller EEPROMs)
+#endif
+
+#define EEFRAMEHDR (EESLOT_NAMELEN + 4)                           // Name + sequence + CRC
+#define EEFRAMESIZE (EEFRAMEHDR + AR_CFG_SIZE)                    // Header + config data
+#define EESLOTSIZE (EEFRAMES * EEFRAMESIZE)
+#define EESLOTS ((EESLOTEND - EESLOTSTART) / EESLOTSIZE)          // Number of available slots
+
+#endif
+
+
+/*
+ * Runtime macros:
+ * 
+ * When macros are enabled, an area at the top of the EEPROM holds macros
+ * defined over the serial port. Each macro is stored as a record made up
+ * of the macro number, a 16-bit length and the macro text. Records are
+ * packed one after the other and the first byte after the last record is
+ * 0xFF. Deleting a macro moves the following records down to close the
+ * gap. A macro stored in EEPROM takes the place of the compiled-in macro
+ * with the same number. The sequencer program is kept in the same area
+ * as record number EEMACRO_SEQ.
+ */
+#if defined(E2END) && (defined(USE_MACROS) || defined(USE_SEQUENCER))
+
+#if (E2END + 1) >= 4096
+  #define EEMACROSIZE 1024            // Size of macro area (ATmega2560/1284)
+#elif (E2END + 1) >= 1024
+  #define EEMACROSIZE 256             // Size of macro area (ATmega328/32u4/644)
+#else
+  #define EEMACROSIZE 128             // Size of macro area (smaller EEPROMs)
+#endif
+
+#define EEMACROEND (E2END + 1)        // End of macro area
+#define EEMACROSTART (EEMACROEND - EEMACROSIZE)
+#define EEMACROS 10                   // Number of macros (0 = startup macro)
+#define EEMACRO_SEQ EEMACROS          // Record number of the sequencer program
+#define EEMACROHDR 3                  // Macro number + length
+
+#endif
+
+
 //  extern Stream& dataStream;
 //  extern Stream& debugStream;
 
@@ -67,5 +137,20 @@ bool epReadData(uint8_t cfgdata[], uint16_t cfgsize);
 void epViewData(Stream& outputStream);
 bool isEepromClear();
 
+#ifdef E2END
+bool epSlotWrite(const char *name, uint8_t cfgdata[], uint16_t cfgsize);
+bool epSlotRead(const char *name, uint8_t cfgdata[], uint16_t cfgsize);
+bool epSlotErase(const char *name, uint16_t cfgsize);
+void epSlotList(Stream& outputStream, uint16_t cfgsize);
+#endif
+
+#if defined(E2END) && (defined(USE_MACROS) || defined(USE_SEQUENCER))
+bool epMacroFind(uint8_t idx, uint16_t &addr, uint16_t &msize);
+char epMacroChar(uint16_t addr);
+bool epMacroWrite(uint8_t idx, const char *data, uint16_t dsize);
+bool epMacroAppend(uint8_t idx, const char *data, uint16_t dsize);
+bool epMacroErase(uint8_t idx);
+#endif
+
 
 #endif // AR488_EEPROM_H
@@ -1,7 +1,11 @@
+#define TRACE_FILE 1
 #include <Arduino.h>
 //#include <SD.h>
 #include "AR488_Config.h"
 #include "AR488_GPIBbus.h"
+#ifdef __AVR__
+  #include <util/delay_basic.h>
+#endif
 
 /***** AR488_GPIB.cpp, ver. 0.51.17, 24/12/2022 *****/
 
@@ -42,7 +46,19 @@ GPIBbus::GPIBbus(){
 //  addressingSuppressed = false;
 //  dataContinuity = false;
   deviceAddressed = false;
+  lsnAddr = 0xFF;
 //  deviceAddressedState = DIDS;
+  termType = TERM_EOR;
+  termLen = 0;
+  termMatch = 0;
+  memset(t1Delay, 0, sizeof(t1Delay));
+  t1Max = 0;
+#ifdef USE_STATS
+  statsClear();
+#endif
+#ifdef SN7516X
+  snInit();
+#endif
 }
 
 
@@ -119,8 +135,8 @@ bool GPIBbus::isController(){
 
 
 /***** Detect selected pin state *****/
-bool GPIBbus::isAsserted(uint8_t gpibsig){
 #if defined(AR488_MCP23S17) || defined(AR488_MCP23017)
+bool GPIBbus::isAsserted(uint8_t gpibsig){
   uint8_t mcpPinAssertedReg = 0;
   // Use MCP function to get MCP23S17 or MCP23017 pin state.
   // If interrupt flagged then update mcpPinAssertedReg register
@@ -136,16 +152,8 @@ bool GPIBbus::isAsserted(uint8_t gpibsig){
 //dataPort.println(mcpPinAssertedReg, BIN);
 //  }
   return (mcpPinAssertedReg & (1<<gpibsig));
-#else
-  // Use digitalRead function to get current Arduino pin state
-  return (digitalRead(gpibsig) == LOW) ? true : false;
-#endif
-
-
-  
-  if (getGpibPinState(gpibsig) == LOW) return true;
-  return false;
 }
+#endif
 
 
 /***** Send the device status byte *****/
@@ -174,6 +182,16 @@ void GPIBbus::setStatus(uint8_t statusByte){
 }
 
 
+/***** Assert or clear SRQ without changing the status byte *****/
+void GPIBbus::setSrq(bool state){
+  if (state) {
+    setSrqSig();
+  } else {
+    clrSrqSig();
+  }
+}
+
+
 /***** Send IFC *****/
 void GPIBbus::sendIFC(){
   // Assert IFC
@@ -446,17 +464,27 @@ bool GPIBbus::sendCmd(uint8_t cmdByte){
  */
 bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte) {
 
-  uint8_t r = 0; //, db;
-  uint8_t bytes[3] = {0};
-  uint8_t eor = cfg.eor&7;
+  uint8_t r = 0;
+  uint8_t db = 0;
   int x = 0;
   bool readWithEoi = false;
   bool eoiDetected = false;
-
-  endByte = endByte;  // meaningless but defeats vcompiler warning!
+  const uint32_t rtmoMicros = (uint32_t)cfg.rtmo * 1000;
+  uint32_t tmo = tmoFirst ? tmoFirst : rtmoMicros;
+  uint32_t elapsed;
+  unsigned long startMicros;
+  unsigned long lastMicros = 0;
+  unsigned long now;
 
   // Reset transmission break flag
   txBreak = 0;
+  rxFlags = 0;
+  rxFirstUs = 0;
+  rxGapUs = 0;
+
+  // Reset the terminator matcher
+  if (termType == TERM_EOR) setTermEorSeq(cfg.eor&7);
+  termMatch = 0;
 
   // EOI detection required ?
   if (cfg.eoi || detectEoi || (cfg.eor==7)) readWithEoi = true;    // Use EOI as terminator
@@ -494,50 +522,83 @@ bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte
   // Ready the data bus
   readyGpibDbus();
 
+#ifdef USE_HS488
+  // The first byte is always read with the interlocked handshake. Only a
+  // talker known to support HS488 is told that we accept it.
+  hsState = (hs488 && hsTalker()) ? HS_FIRST : HS_OFF;
+#endif
+
+  startMicros = micros();
+
   // Perform read of data (r=0: data read OK; r>0: GPIB read error);
   while (r == 0) {
 
     // Tranbreak > 0 indicates break condition
-    if (txBreak) break;
+    if (txBreak) {
+      rxFlags |= RX_ABORT;
+      break;
+    }
 
     // ATN asserted
-    if (isAsserted(ATN)) break;
+    if (isAsserted(ATN)) {
+      rxFlags |= RX_ABORT;
+      break;
+    }
+
+    // Limit the wait to the time left of the total transfer timeout
+    if (tmoTotal) {
+      elapsed = micros() - startMicros;
+      if (elapsed >= tmoTotal) {
+        r = 4;
+        break;
+      }
+      if ((tmoTotal - elapsed) < tmo) tmo = tmoTotal - elapsed;
+    }
 
     // Read the next character on the GPIB bus
-    r = readByte(&bytes[0], readWithEoi, &eoiDetected);
+    r = readByte(&db, readWithEoi, &eoiDetected, tmo);
 
     if (isAsserted(ATN)) r = 2;
 
     // If IFC or ATN asserted then break here
-    if ( (r==1) || (r==2) ) break;
+    if ( (r==1) || (r==2) ) {
+      rxFlags |= RX_ABORT;
+      break;
+    }
 
     // If successfully received character
     if (r==0) {
 #ifdef DEBUG_GPIBbus_RECEIVE
-      DB_HEX_PRINT(bytes[0]);
+      DB_HEX_PRINT(db);
 #else
       // Output the character to the serial port
-      dataStream.print((char)bytes[0]);
+      dataStream.print((char)db);
 #endif
 
       // Byte counter
       x++;
 
-      // EOI detection enabled and EOI detected?
-      if (readWithEoi) {
-        if (eoiDetected) break;
-      }else{
-        // Has a termination sequence been found ?
-        if (detectEndByte) {
-          if (r == endByte) break;
-        }else{
-          if (isTerminatorDetected(bytes, eor)) break;
-        }
+      // Record the time to the first byte and the longest gap between bytes
+      now = micros();
+      if (x == 1) {
+        rxFirstUs = now - startMicros;
+      }else if ((now - lastMicros) > rxGapUs) {
+        rxGapUs = now - lastMicros;
       }
+      lastMicros = now;
+
+      // Subsequent bytes use the inter-byte timeout
+      tmo = tmoNext ? tmoNext : rtmoMicros;
 
-      // Shift last three bytes in memory
-      bytes[2] = bytes[1];
-      bytes[1] = bytes[0];
+      // EOI detection enabled and EOI detected?
+      if (readWithEoi && eoiDetected) break;
+
+      // Has the requested end byte or a termination sequence been found ?
+      if (detectEndByte) {
+        if (db == endByte) break;
+      }else if (!readWithEoi) {
+        if (isTerminatorDetected(db)) break;
+      }
     }else{
       // Stop (error or timeout)
       break;
@@ -560,8 +621,11 @@ bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte
 #endif
     // If eot_enabled then add EOT character
     if (cfg.eot_en) dataStream.print(cfg.eot_ch);
+    rxFlags |= RX_EOI;
   }
 
+  if (r > 2) rxFlags |= RX_TMO;
+
   // Verbose timeout error
 #ifdef DEBUG_GPIBbus_RECEIVE
   if (r > 0) {
@@ -589,6 +653,10 @@ bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte
     setControls(DIDS);
   }
 
+#ifdef USE_HS488
+  hsState = HS_OFF;
+#endif
+
   // Reset break flag
   if (txBreak) txBreak = false;
 
@@ -596,6 +664,11 @@ bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte
   DB_PRINT(F("done."),"");
 #endif
 
+#ifdef USE_STATS
+  statXfer(cfg.paddr, x, rxFlags);
+#endif
+  TRACE(x, rxFlags);
+
   if (r > 0) return ERR;
 
   return OK;
@@ -603,10 +676,63 @@ bool GPIBbus::receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte
 }
 
 
+/***** Use the terminator selected by ++eor *****/
+void GPIBbus::setTermEor(){
+  termType = TERM_EOR;
+}
+
+
+/***** Use a sequence of up to TERM_MAXLEN bytes as terminator *****/
+bool GPIBbus::setTermSeq(uint8_t *seq, uint8_t len){
+  if ( (len == 0) || (len > TERM_MAXLEN) ) return ERR;
+  memcpy(termSeq, seq, len);
+  termLen = len;
+  buildTermTable();
+  termType = TERM_SEQ;
+  return OK;
+}
+
+
+/***** Use any byte from a set (256-bit bitmap) as terminator *****/
+void GPIBbus::setTermSet(uint8_t bitmap[32]){
+  memcpy(termSet, bitmap, 32);
+  termType = TERM_SET;
+}
+
+
+/***** Return the terminator type *****/
+uint8_t GPIBbus::getTermType(){
+  return termType;
+}
+
+
+/***** Copy the terminator sequence and return its length *****/
+uint8_t GPIBbus::getTermSeq(uint8_t *seq){
+  if (termType == TERM_EOR) setTermEorSeq(cfg.eor&7);
+  memcpy(seq, termSeq, termLen);
+  return termLen;
+}
+
+
+/***** Is the byte in the terminator set? *****/
+bool GPIBbus::isTermByte(uint8_t db){
+  return (termSet[db>>3] & (1<<(db&7)));
+}
+
+
 /***** Send a series of characters as data to the GPIB bus *****/
 void GPIBbus::sendData(char *data, uint8_t dsize) {
 
-  bool err = false;
+  uint8_t err = 0;
+#ifdef USE_STATS
+  uint16_t sent = 0;
+#endif
+#ifdef USE_HS488
+  unsigned long startMicros;
+
+  // The first byte is always sent with the interlocked handshake
+  hsState = hs488 ? HS_FIRST : HS_OFF;
+#endif
 
   // Set control pins for writing data (ATN unasserted)
   if (cfg.cmode == 2) {
@@ -636,6 +762,9 @@ void GPIBbus::sendData(char *data, uint8_t dsize) {
 #endif
 
     if (err) break;
+#ifdef USE_STATS
+    sent++;
+#endif
   }
 
 #ifdef DEBUG_GPIBbus_SEND
@@ -661,18 +790,38 @@ void GPIBbus::sendData(char *data, uint8_t dsize) {
     }
   }
 
+#ifdef USE_HS488
+  // Wait for the listeners to take the last byte sent without interlock
+  if (hsState == HS_ACTIVE) {
+    startMicros = micros();
+    while (getGpibPinState(NRFD) == LOW) {
+      if ( (cfg.cmode == 1) && (isAsserted(IFC) || isAsserted(ATN)) ) break;
+      if ((unsigned long)(micros() - startMicros) >= ((unsigned long)cfg.rtmo * 1000)) break;
+    }
+    setGpibDbus(0);
+  }
+  hsState = HS_OFF;
+#endif
+
   // If EOI enabled and no more data to follow then assert EOI
 //  if (cfg.eoi && !dataContinuity) {
   if (cfg.eoi) {
     setGpibState(0b00010000, 0b00010000, 1);
     setGpibState(0b00000000, 0b00010000, 0);
-    delayMicroseconds(40);
+    delayMicroseconds(eoiUs);
     setGpibState(0b00010000, 0b00010000, 0);
 #ifdef DEBUG_GPIBbus_SEND
     DB_PRINT(F("Asserted EOI"),"");
 #endif
   }
 
+#ifdef USE_STATS
+  // Count against the instrument addressed to listen, which need not be ++addr
+  statXfer( ((cfg.cmode == 2) && (lsnAddr != 0xFF)) ? lsnAddr : cfg.paddr, sent,
+            (err == 0) ? 0 : ((err < 3) ? RX_ABORT : RX_TMO) );
+#endif
+  TRACE(dsize, err);
+
   if (cfg.cmode == 2) {   // Controller mode
 /*    
     if (!err) {
@@ -721,6 +870,44 @@ void GPIBbus::sendData(char *data, uint8_t dsize) {
 
 
 
+/***** Handshake statistics *****/
+#ifdef USE_STATS
+
+/***** Clear all statistics *****/
+void GPIBbus::statsClear(){
+  memset(statHist, 0, sizeof(statHist));
+  memset(statBytes, 0, sizeof(statBytes));
+  memset(statTmo, 0, sizeof(statTmo));
+  memset(statAbort, 0, sizeof(statAbort));
+}
+
+
+/***** Add a handshake stage time to its histogram *****/
+/*
+ * Bins are 4 times wider than the last: <8us, <32us, ... >=32768us
+ */
+void GPIBbus::statTime(uint8_t stage, uint32_t us){
+  uint8_t bin = 0;
+  us = us >> 3;
+  while (us && (bin < (STAT_BINS - 1))) {
+    us = us >> 2;
+    bin++;
+  }
+  if (statHist[stage][bin] < 0xFFFF) statHist[stage][bin]++;
+}
+
+
+/***** Add a transfer to the counters for an address *****/
+void GPIBbus::statXfer(uint8_t addr, uint16_t bytes, uint8_t flags){
+  if (addr >= STAT_ADDRS) return;
+  statBytes[addr] += bytes;
+  if ((flags & RX_TMO) && (statTmo[addr] < 0xFFFF)) statTmo[addr]++;
+  if ((flags & RX_ABORT) && (statAbort[addr] < 0xFFFF)) statAbort[addr]++;
+}
+
+#endif
+
+
 /***** Signal to break a GPIB transmission *****/
 void GPIBbus::signalBreak(){
   txBreak = true;
@@ -737,46 +924,44 @@ void GPIBbus::signalBreak(){
  */
 void GPIBbus::setControls(uint8_t state) {
 
+  uint8_t dir;    // Pin direction: 0=input, 1=output
+  uint8_t val;    // Pin state: 0=LOW, 1=HIGH/INPUT_PULLUP
+  uint8_t mask;   // Lines affected: 0=unaffected, 1=enabled
+#ifdef SN7516X
+  uint8_t te;     // SN7516x TE: HIGH=talk, LOW=listen
+#endif
+
+  TRACE(state, cstate);
+
   // Switch state
   switch (state) {
 
     // Controller states
     case CINI:  // Initialisation
-      // Set pin direction
-      setGpibState(0b10111000, 0b11111111, 1);
-      // Set pin state
-      setGpibState(0b11011111, 0b11111111, 0);
+      dir = 0b10111000; val = 0b11011111; mask = 0b11111111;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,LOW);
-  #ifdef SN7516X_DC
-        digitalWrite(SN7516X_DC,LOW);
-  #endif
-  #ifdef SN7516X_SC
-        digitalWrite(SN7516X_SC,HIGH);
-  #endif
-#endif      
+      te = LOW;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Initialised GPIB control mode"),"");
 #endif
       break;
 
     case CIDS:  // Controller idle state
-      setGpibState(0b10111000, 0b10011110, 1);
-      setGpibState(0b11011111, 0b10011110, 0);
+      dir = 0b10111000; val = 0b11011111; mask = 0b10011110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,LOW);
-#endif      
+      te = LOW;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines to idle state"),"");
 #endif
       break;
 
     case CCMS:  // Controller active - send commands
-      setGpibState(0b10111001, 0b10011111, 1);
-      setGpibState(0b01011111, 0b10011111, 0);
+      dir = 0b10111001; val = 0b01011111; mask = 0b10011111;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,HIGH);
-#endif      
+      te = HIGH;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines for sending a command"),"");
 #endif
@@ -784,22 +969,20 @@ void GPIBbus::setControls(uint8_t state) {
 
     case CLAS:  // Controller - read data bus
       // Set state for receiving data
-      setGpibState(0b10100110, 0b10011110, 1);
-      setGpibState(0b11011000, 0b10011110, 0);
+      dir = 0b10100110; val = 0b11011000; mask = 0b10011110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,LOW);
-#endif      
+      te = LOW;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines for reading data"),"");
 #endif
       break;
 
     case CTAS:  // Controller - write data bus
-      setGpibState(0b10111001, 0b10011110, 1);
-      setGpibState(0b11011111, 0b10011110, 0);
+      dir = 0b10111001; val = 0b11011111; mask = 0b10011110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,HIGH);
-#endif      
+      te = HIGH;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines for writing data"),"");
 #endif
@@ -809,66 +992,82 @@ void GPIBbus::setControls(uint8_t state) {
 
     // Listener states
     case DINI:  // Listner initialisation
+      dir = 0b00000000; val = 0b11111111; mask = 0b11111111;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,HIGH);
-  #ifdef SN7516X_DC
-        digitalWrite(SN7516X_DC,HIGH);
-  #endif
-  #ifdef SN7516X_SC
-        digitalWrite(SN7516X_SC,LOW);
-  #endif
-#endif      
-      setGpibState(0b00000000, 0b11111111, 1);
-      setGpibState(0b11111111, 0b11111111, 0);
-      // Set data bus to idle state
-      readyGpibDbus();
+      te = HIGH;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Initialised GPIB listener mode"),"");
 #endif
       break;
 
     case DIDS:  // Device idle state
+      dir = 0b00000000; val = 0b11111111; mask = 0b00001110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,HIGH);
-#endif      
-      setGpibState(0b00000000, 0b00001110, 1);
-      setGpibState(0b11111111, 0b00001110, 0);
-      // Set data bus to idle state
-      readyGpibDbus();
+      te = HIGH;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines to idle state"),"");
 #endif
       break;
 
     case DLAS:  // Device listner active (actively listening - can handshake)
+      dir = 0b00000110; val = 0b11111001; mask = 0b00011110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,LOW);
-#endif      
-      setGpibState(0b00000110, 0b00011110, 1);
-      setGpibState(0b11111001, 0b00011110, 0);
+      te = LOW;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines to idle state"),"");
 #endif
       break;
 
     case DTAS:  // Device talker active (sending data)
+      dir = 0b00011000; val = 0b11111001; mask = 0b00011110;
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE,HIGH);
-#endif      
-      setGpibState(0b00011000, 0b00011110, 1);
-      setGpibState(0b11111001, 0b00011110, 0);
+      te = HIGH;
+#endif
 #ifdef DEBUG_GPIBbus_CONTROL
       DB_PRINT(F("Set GPIB lines for listening as addresed device"),"");
 #endif
       break;
-#ifdef DEBUG_GPIBbus_CONTROL
+
     default:
+#ifdef DEBUG_GPIBbus_CONTROL
       // Should never get here!
-      //      setGpibState(0b00000110, 0b10111001, 0b11111111);
       DB_PRINT(F("Unknown GPIB state requested!"),"");
 #endif
+      cstate = state;
+      return;
   }
 
+#ifdef SN7516X
+  // Release lines that are becoming inputs before the transceivers turn
+  // round, and only drive new outputs afterwards, so that the Arduino and
+  // the transceivers never drive the same line against each other
+  setGpibState(0b00000000, mask & ~dir, 1);
+  // The SN75160 drives the data pins once TE is LOW (writeByte() leaves
+  // them as outputs)
+  if (te == LOW) readyGpibDbus();
+  snWrite(SN_TE, te);
+  if (state == CINI) {
+    snWrite(SN_DC, LOW);
+    snWrite(SN_SC, HIGH);
+  }else if (state == DINI) {
+    snWrite(SN_DC, HIGH);
+    snWrite(SN_SC, LOW);
+  }
+  setGpibState(val, mask, 0);
+  setGpibState(dir, mask & dir, 1);
+#else
+  // Set pin direction
+  setGpibState(dir, mask, 1);
+  // Set pin state
+  setGpibState(val, mask, 0);
+#endif
+
+  // Set data bus to idle state
+  if ((state == DINI) || (state == DIDS)) readyGpibDbus();
+
   // Save state
   cstate = state;
 
@@ -887,6 +1086,39 @@ void GPIBbus::setDataVal(uint8_t value){
 }
 
 
+/***** Set the data settling time (T1) for an address (0xFF = all) *****/
+/*
+ * The time is converted to a delay count once here so that writeByte()
+ * does not need to calculate anything. On AVR the count is in units of 4
+ * CPU cycles, elsewhere it is in microseconds. The time is rounded up.
+ */
+void GPIBbus::setT1(uint8_t addr, uint16_t ns){
+  uint16_t count;
+  uint8_t i;
+#ifdef __AVR__
+  count = ((uint32_t)ns * clockCyclesPerMicrosecond() + 3999) / 4000;
+#else
+  count = ((uint32_t)ns + 999) / 1000;
+#endif
+  t1Max = 0;
+  for (i = 0; i < T1_ADDRS; i++) {
+    if ( (addr == 0xFF) || (addr == i) ) t1Delay[i] = count;
+    if (t1Delay[i] > t1Max) t1Max = t1Delay[i];
+  }
+}
+
+
+/***** Return the data settling time for an address in nanoseconds *****/
+uint32_t GPIBbus::getT1(uint8_t addr){
+  if (addr >= T1_ADDRS) return 0;
+#ifdef __AVR__
+  return (uint32_t)t1Delay[addr] * 4000 / clockCyclesPerMicrosecond();
+#else
+  return (uint32_t)t1Delay[addr] * 1000;
+#endif
+}
+
+
 /***** Flag more data to come - suppress addressing *****/ 
 /*
 void GPIBbus::setDataContinuity(bool flag){
@@ -934,6 +1166,7 @@ bool GPIBbus::addressDevice(uint8_t addr, bool talk) {
   } else {
     // Device to listen, controller to talk
     if (sendCmd(GC_LAD + addr)) return ERR;
+    lsnAddr = addr;
   }
 
   // Set flag
@@ -984,19 +1217,28 @@ void GPIBbus::clearDataBus(){
 /*
  * (- this function is called in a loop to read data    )
  * (- the GPIB bus must already be configured to listen )
+ * (- tmo is the timeout in microseconds, 0 = use rtmo  )
  */
-uint8_t GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
+uint8_t GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi, uint32_t tmo) {
 
-  unsigned long startMillis = millis();
-  unsigned long currentMillis = startMillis + 1;
-  const unsigned long timeval = cfg.rtmo;
+  unsigned long startMicros = micros();
+  unsigned long currentMicros = startMicros + 1;
+  const unsigned long timeval = tmo ? tmo : (unsigned long)cfg.rtmo * 1000;
   uint8_t stage = 4;
 
   bool atnStat = isAsserted(ATN); // Capture state of ATN
   *eoi = false;
 
+#ifdef USE_HS488
+  if (hsState == HS_ACTIVE) {
+    stage = readByteHs(db, readWithEoi, eoi, timeval);
+    if (stage != HS_FALLBACK) return stage;
+    stage = 4;
+  }
+#endif
+
   // Wait for interval to expire
-  while ( (unsigned long)(currentMillis - startMillis) < timeval ) {
+  while ( (unsigned long)(currentMicros - startMicros) < timeval ) {
 
     if (cfg.cmode == 1) {
       // If IFC has been asserted then abort
@@ -1029,6 +1271,9 @@ uint8_t GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
         // Assert NRFD (Busy reading data)
         setGpibState(0b00000000, 0b00000100, 0);
         stage = 7;
+#ifdef USE_STATS
+        statTime(STAT_DAV, currentMicros - startMicros);
+#endif
       }
     }
 
@@ -1046,18 +1291,30 @@ uint8_t GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
       // Wait for DAV to go HIGH indicating data no longer valid (i.e. transfer complete)
 //      if (digitalRead(DAV) == HIGH) {
       if (getGpibPinState(DAV) == HIGH) {
+#ifdef USE_HS488
+        if (hsState == HS_FIRST) {
+          // Leave NDAC unasserted to tell the talker that we accept HS488
+          hsState = HS_ACTIVE;
+        }else{
+          // Re-assert NDAC - handshake complete, ready to accept data again
+          setGpibState(0b00000000, 0b00000010, 0);
+        }
+#else
         // Re-assert NDAC - handshake complete, ready to accept data again
         setGpibState(0b00000000, 0b00000010, 0);
+#endif
         stage = 9;
         break;     
       }
     }
 
     // Increment time
-    currentMillis = millis();
+    currentMicros = micros();
 
   }
 
+  TRACE(*db, stage);
+
   // Completed
   if (stage == 9) return 0;
 
@@ -1079,13 +1336,22 @@ uint8_t GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
 
 
 uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
-  unsigned long startMillis = millis();
-  unsigned long currentMillis = startMillis + 1;
-  const unsigned long timeval = cfg.rtmo;
+  unsigned long startMicros = micros();
+  unsigned long currentMicros = startMicros + 1;
+  const unsigned long timeval = (unsigned long)cfg.rtmo * 1000;
+  const uint16_t t1 = t1Count();
   uint8_t stage = 4;
+#ifdef USE_STATS
+  unsigned long davMicros = 0;
+#endif
+
+#ifdef USE_HS488
+  if (hsState == HS_CHECK) hsCheck();
+  if (hsState == HS_ACTIVE) return writeByteHs(db, isLastByte);
+#endif
 
   // Wait for interval to expire
-  while ( (unsigned long)(currentMillis - startMillis) < timeval ) {
+  while ( (unsigned long)(currentMicros - startMicros) < timeval ) {
 
     if (cfg.cmode == 1) {
       // If IFC has been asserted then abort
@@ -1122,8 +1388,9 @@ uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
     }
 
     if (stage == 6){
-      // Place data on the bus
+      // Place data on the bus and allow it to settle (T1)
       setGpibDbus(db);
+      settleDelay(t1);
       if (cfg.eoi && isLastByte) {
         // If EOI enabled and this is the last byte then assert DAV and EOI
 #ifdef DEBUG_GPIBbus_SEND
@@ -1135,6 +1402,10 @@ uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
         setGpibState(0b00000000, 0b00001000, 0);
       }
       stage = 7;
+#ifdef USE_STATS
+      statTime(STAT_NRFD, currentMicros - startMicros);
+      davMicros = currentMicros;
+#endif
     }
 
     if (stage == 7) {
@@ -1148,15 +1419,20 @@ uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
 //      if (digitalRead(NDAC) == HIGH) {
       if (getGpibPinState(NDAC) == HIGH) {
         stage = 9;
+#ifdef USE_STATS
+        statTime(STAT_NDAC, micros() - davMicros);
+#endif
         break;
       }
     }
 
     // Increment time
-    currentMillis = millis();
+    currentMicros = micros();
 
   }
 
+  TRACE(db, stage);
+
   // Handshake complete
   if (stage == 9) {
     if (cfg.eoi && isLastByte) {
@@ -1168,6 +1444,9 @@ uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
     }
     // Reset the data bus
     setGpibDbus(0);
+#ifdef USE_HS488
+    if (hsState == HS_FIRST) hsState = HS_CHECK;
+#endif
     return 0;
   }
 
@@ -1211,46 +1490,301 @@ uint8_t GPIBbus::writeByte(uint8_t db, bool isLastByte) {
 /********** PRIVATE FUNCTIONS **********/
 
 
-/***** Check for terminator *****/
-bool GPIBbus::isTerminatorDetected(uint8_t bytes[3], uint8_t eorSequence){
-  // Look for specified terminator (CR+LF by default)
+/***** Load the terminator sequence for an EOR setting *****/
+void GPIBbus::setTermEorSeq(uint8_t eorSequence){
   switch (eorSequence) {
-    case 0:
-        // CR+LF terminator
-        if (bytes[0]==LF && bytes[1]==CR) return true;
-        break;
     case 1:
         // CR only as terminator
-        if (bytes[0]==CR) return true;
+        termSeq[0] = CR;
+        termLen = 1;
         break;
     case 2:
         // LF only as terminator
-        if (bytes[0]==LF) return true;
+        termSeq[0] = LF;
+        termLen = 1;
         break;
     case 3:
         // No terminator (will rely on timeout)
+        termLen = 0;
         break;
     case 4:
         // Keithley can use LF+CR instead of CR+LF
-        if (bytes[0]==CR && bytes[1]==LF) return true;
+        termSeq[0] = LF;
+        termSeq[1] = CR;
+        termLen = 2;
         break;
     case 5:
         // Solarton (possibly others) can also use ETX (0x03)
-        if (bytes[0]==0x03) return true;
+        termSeq[0] = 0x03;
+        termLen = 1;
         break;
     case 6:
         // Solarton (possibly others) can also use CR+LF+ETX (0x03)
-        if (bytes[0]==0x03 && bytes[1]==LF && bytes[2]==CR) return true;
+        termSeq[0] = CR;
+        termSeq[1] = LF;
+        termSeq[2] = 0x03;
+        termLen = 3;
         break;
     default:
         // Use CR+LF terminator by default
-        if (bytes[0]==LF && bytes[1]==CR) return true;
+        termSeq[0] = CR;
+        termSeq[1] = LF;
+        termLen = 2;
         break;
   }
+  buildTermTable();
+}
+
+
+/***** Build the fall back table for the terminator sequence *****/
+/*
+ * termNext[i] is the length of the longest proper prefix of the sequence
+ * that is also a suffix of its first i+1 bytes. On a mismatch the matcher
+ * falls back to that prefix instead of starting again, so each received
+ * byte is examined at most a small, fixed number of times.
+ */
+void GPIBbus::buildTermTable(){
+  uint8_t k = 0;
+  if (termLen == 0) return;
+  termNext[0] = 0;
+  for (uint8_t i=1; i<termLen; i++) {
+    while ( (k > 0) && (termSeq[i] != termSeq[k]) ) k = termNext[k-1];
+    if (termSeq[i] == termSeq[k]) k++;
+    termNext[i] = k;
+  }
+}
+
+
+/***** Check for terminator *****/
+/*
+ * Called with each received byte. Returns true once the terminator
+ * sequence has been received, or a byte from the terminator set.
+ */
+bool GPIBbus::isTerminatorDetected(uint8_t db){
+  if (termType == TERM_SET) return (termSet[db>>3] & (1<<(db&7)));
+  if (termLen == 0) return false;
+  while ( (termMatch > 0) && (termSeq[termMatch] != db) ) termMatch = termNext[termMatch-1];
+  if (termSeq[termMatch] == db) termMatch++;
+  if (termMatch == termLen) {
+    termMatch = 0;
+    return true;
+  }
   return false;
 }
 
 
+/***** Delay count for the data settling time of the current transfer *****/
+/*
+ * Data sent to the instrument addressed to listen uses its own setting,
+ * even when that is not ++addr (e.g. the poller). Commands, which all
+ * instruments receive, and device mode use the longest one.
+ */
+uint16_t GPIBbus::t1Count(){
+  uint8_t addr = (lsnAddr < T1_ADDRS) ? lsnAddr : cfg.paddr;
+  if ( (cstate == CTAS) && (addr < T1_ADDRS) ) return t1Delay[addr];
+  return t1Max;
+}
+
+
+/***** Wait for the data settling time *****/
+void GPIBbus::settleDelay(uint16_t count){
+  if (count == 0) return;
+#ifdef __AVR__
+  // 4 CPU cycles per count
+  _delay_loop_2(count);
+#else
+  delayMicroseconds(count);
+#endif
+}
+
+
+#ifdef USE_HS488
+
+// Busy-wait iterations for a number of microseconds (a DAV check takes about 8 cycles)
+#define HS_LOOPS(us) ((uint32_t)(us) * clockCyclesPerMicrosecond() / 8)
+
+/***** Is the talker known to support HS488? *****/
+/*
+ * Leaving NDAC unasserted after the first byte makes an interlocked
+ * talker end its DAV pulse at once, so the HS488 listener handshake is
+ * only used with talkers set with ++hs488 talk. In device mode the
+ * talker is not known and only HS_ANY_TALKER applies.
+ */
+bool GPIBbus::hsTalker() {
+  if (hsTalkers & (1UL << HS_ANY_TALKER)) return true;
+  if ( (cfg.cmode == 2) && (cfg.paddr < HS_ANY_TALKER) ) return (hsTalkers & (1UL << cfg.paddr)) ? true : false;
+  return false;
+}
+
+
+/***** Check whether all listeners accept the HS488 handshake *****/
+/*
+ * An interlocked listener asserts NDAC before it unasserts NRFD, so NDAC
+ * still unasserted once NRFD is unasserted means that every listener has
+ * left NDAC unasserted after the first byte, as a HS488 listener does.
+ */
+void GPIBbus::hsCheck() {
+  unsigned long startMicros = micros();
+  const unsigned long timeval = (unsigned long)cfg.rtmo * 1000;
+
+  hsState = HS_OFF;
+
+  while ( (unsigned long)(micros() - startMicros) < timeval ) {
+    if ( (cfg.cmode == 1) && (isAsserted(IFC) || isAsserted(ATN)) ) return;
+    if (getGpibPinState(NRFD) == HIGH) {
+      if (getGpibPinState(NDAC) == HIGH) {
+        hsState = HS_ACTIVE;
+      }else{
+        hsFallback++;
+      }
+      return;
+    }
+  }
+}
+
+
+/***** Read a SINGLE BYTE of data using the HS488 handshake *****/
+/*
+ * NRFD is unasserted for short windows with interrupts disabled so that
+ * a byte held on the bus for only hsPulse microseconds is not missed.
+ * NDAC is left unasserted. Returns HS_FALLBACK when the talker has gone
+ * back to the interlocked handshake.
+ */
+uint8_t GPIBbus::readByteHs(uint8_t *db, bool readWithEoi, bool *eoi, uint32_t tmo) {
+  unsigned long startMicros = micros();
+  unsigned long elapsed;
+  uint32_t loops;
+  bool dav = false;
+
+  while (!dav) {
+
+    elapsed = micros() - startMicros;
+    if (elapsed >= tmo) return 6;
+    // Nothing received for a while - talker is not using HS488
+    if (elapsed >= HS_IDLE_US) break;
+
+    if (cfg.cmode == 1) {
+      if (isAsserted(IFC)) return 1;
+      if (isAsserted(ATN)) return 2;
+    }
+
+    noInterrupts();
+    // Unassert NRFD (ready for data) and wait for DAV
+    setGpibState(0b00000100, 0b00000100, 0);
+    loops = HS_LOOPS(HS_WINDOW_US);
+    while (loops--) {
+      if (getGpibPinState(DAV) == LOW) {
+        dav = true;
+        break;
+      }
+    }
+    if (!dav) {
+      // Assert NRFD but catch a byte placed just before the talker saw it
+      setGpibState(0b00000000, 0b00000100, 0);
+      loops = HS_LOOPS(HS_GUARD_US);
+      while (loops--) {
+        if (getGpibPinState(DAV) == LOW) {
+          dav = true;
+          break;
+        }
+      }
+    }
+    if (dav) {
+      // Read the byte and assert NRFD (busy) before the DAV pulse ends
+      if (readWithEoi && isAsserted(EOI)) *eoi = true;
+      *db = readGpibDbus();
+      setGpibState(0b00000000, 0b00000100, 0);
+    }
+    interrupts();
+  }
+
+  if (dav) {
+    // Wait for the end of the DAV pulse
+    while (getGpibPinState(DAV) == LOW) {
+      if ((unsigned long)(micros() - startMicros) >= tmo) return 8;
+    }
+    hsBytes++;
+    TRACE(*db, 9);
+    return 0;
+  }
+
+  // Re-assert NDAC and continue with the interlocked handshake
+  setGpibState(0b00000000, 0b00000010, 0);
+  hsState = HS_OFF;
+  hsFallback++;
+  return HS_FALLBACK;
+}
+
+
+/***** Write a SINGLE BYTE of data using the HS488 handshake *****/
+/*
+ * The byte is held on the bus with DAV asserted for hsPulse microseconds
+ * and is not acknowledged. Interrupts are disabled from the last check
+ * of NRFD to the end of the pulse. It is written with the interlocked
+ * handshake instead if a listener has asserted NDAC again.
+ */
+uint8_t GPIBbus::writeByteHs(uint8_t db, bool isLastByte) {
+  unsigned long startMicros = micros();
+  const unsigned long timeval = (unsigned long)cfg.rtmo * 1000;
+  const uint8_t sigs = (cfg.eoi && isLastByte) ? 0b00011000 : 0b00001000;
+  const uint16_t t1 = t1Count();
+#ifdef USE_STATS
+  unsigned long waited;
+#endif
+
+  while (true) {
+    // Wait for NRFD to go HIGH (all listeners ready)
+    while (getGpibPinState(NRFD) == LOW) {
+      if (cfg.cmode == 1) {
+        if (isAsserted(IFC)) {
+          setControls(DLAS);
+          return 1;
+        }
+        if (isAsserted(ATN)) {
+          setControls(DLAS);
+          return 2;
+        }
+      }
+      if ((unsigned long)(micros() - startMicros) >= timeval) return 5;
+    }
+#ifdef USE_STATS
+    waited = micros() - startMicros;
+#endif
+    // The listener only watches DAV for HS_GUARD_US once its NRFD window
+    // has closed, so nothing may delay the pulse once NRFD has been seen
+    noInterrupts();
+    if (getGpibPinState(NRFD) == HIGH) break;
+    interrupts();
+  }
+
+  // A listener has gone back to the interlocked handshake
+  if (getGpibPinState(NDAC) == LOW) {
+    interrupts();
+    hsState = HS_OFF;
+    hsFallback++;
+    return writeByte(db, isLastByte);
+  }
+
+  // Place data on the bus and pulse DAV (and EOI on the last byte)
+  setGpibDbus(db);
+  settleDelay(t1);
+  setGpibState(0b00000000, sigs, 0);
+  delayMicroseconds(hsPulse);
+  setGpibState(sigs, sigs, 0);
+  interrupts();
+
+#ifdef USE_STATS
+  statTime(STAT_NRFD, waited);
+#endif
+
+  hsBytes++;
+  TRACE(db, 9);
+  return 0;
+}
+
+#endif
+
+
 /***** Set the SRQ signal *****/
 void GPIBbus::setSrqSig() {
   // Set SRQ line to OUTPUT HIGH (asserted)
@@ -1267,6 +1801,46 @@ void GPIBbus::clrSrqSig() {
 }
 
 
+#ifdef SN7516X
+/***** Resolve the SN7516x control pins to their port registers *****/
+void GPIBbus::snInit() {
+  snPin[SN_TE] = SN7516X_TE;
+#ifdef SN7516X_DC
+  snPin[SN_DC] = SN7516X_DC;
+#else
+  snPin[SN_DC] = 0xFF;
+#endif
+#ifdef SN7516X_SC
+  snPin[SN_SC] = SN7516X_SC;
+#else
+  snPin[SN_SC] = 0xFF;
+#endif
+#ifdef __AVR__
+  for (uint8_t i=0; i<3; i++) {
+    if (snPin[i] == 0xFF) continue;
+    snReg[i] = portOutputRegister(digitalPinToPort(snPin[i]));
+    snBit[i] = digitalPinToBitMask(snPin[i]);
+  }
+#endif
+}
+
+
+/***** Set an SN7516x control pin (TE, DC or SC) *****/
+void GPIBbus::snWrite(uint8_t sig, uint8_t state) {
+  if (snPin[sig] == 0xFF) return;   // Pin not used on this board
+#ifdef __AVR__
+  if (state) {
+    *snReg[sig] |= snBit[sig];
+  }else{
+    *snReg[sig] &= ~snBit[sig];
+  }
+#else
+  digitalWrite(snPin[sig], state);
+#endif
+}
+#endif
+
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** GPIB CLASS PRIVATE FUNCTIONS *****/
 /****************************************/
@@ -76,6 +76,51 @@
 #define NO_EOI false
 #define WITH_EOI true
 
+/***** Receive status flags (rxFlags) *****/
+#define RX_EOI 0x01     // Read ended with EOI
+#define RX_TMO 0x02     // Read timed out
+#define RX_ABORT 0x04   // Read aborted by ATN, IFC or break
+
+/***** Receive terminator types *****/
+#define TERM_EOR 0      // Terminator selected by cfg.eor
+#define TERM_SEQ 1      // Sequence of up to TERM_MAXLEN bytes
+#define TERM_SET 2      // Any single byte from a set
+#define TERM_MAXLEN 8   // Longest terminator sequence
+
+/***** Bus timing *****/
+#define T1_ADDRS 31     // Per-address data settling times (addresses 0-30)
+#define EOI_US 40       // Default EOI pulse width in microseconds
+
+/***** SN7516x control pins *****/
+#ifdef SN7516X
+#define SN_TE 0         // Talk enable
+#define SN_DC 1         // Direction control
+#define SN_SC 2         // System controller
+#endif
+
+/***** Handshake statistics *****/
+#ifdef USE_STATS
+#define STAT_DAV 0      // Read: wait for talker to assert DAV
+#define STAT_NRFD 1     // Write: wait for listeners to be ready
+#define STAT_NDAC 2     // Write: wait for listeners to accept data
+#define STAT_STAGES 3
+#define STAT_BINS 8     // Histogram bins: <8us, <32us, ... <32768us, >=32768us
+#define STAT_ADDRS 31   // Per-address counters (addresses 0-30)
+#endif
+
+/***** HS488 handshake states *****/
+#ifdef USE_HS488
+#define HS_OFF 0        // Interlocked handshake
+#define HS_FIRST 1      // First byte of the transfer (interlocked)
+#define HS_CHECK 2      // Talker: check listener capability before the next byte
+#define HS_ACTIVE 3     // Non-interlocked handshake
+#define HS_FALLBACK 0xFF  // readByteHs(): continue with the interlocked handshake
+#define HS_WINDOW_US 200  // Listener: NRFD unasserted window with interrupts disabled
+#define HS_GUARD_US 20    // Listener: DAV watched this long after re-asserting NRFD
+#define HS_IDLE_US 2000   // Listener: no byte within this time - talker is not HS488
+#define HS_ANY_TALKER 31  // hsTalkers bit: read any talker with HS488 (talker unknown in device mode)
+#endif
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** GPIB COMMAND & STATUS DEFINITIONS *****/
 /*********************************************/
@@ -121,6 +166,32 @@ class GPIBbus {
 
     uint8_t cstate = 0;
 
+    uint8_t rxFlags = 0;  // Status of last receiveData()
+
+    uint32_t tmoFirst = 0;  // First byte timeout in microseconds (0 = use rtmo)
+    uint32_t tmoNext = 0;   // Inter-byte timeout in microseconds (0 = use rtmo)
+    uint32_t tmoTotal = 0;  // Total transfer timeout in microseconds (0 = none)
+
+    uint32_t rxFirstUs = 0; // Time to the first byte of the last read (microseconds)
+    uint32_t rxGapUs = 0;   // Longest gap between bytes of the last read (microseconds)
+
+    uint8_t eoiUs = EOI_US; // EOI pulse width at the end of sendData (microseconds)
+
+#ifdef USE_STATS
+    uint16_t statHist[STAT_STAGES][STAT_BINS];  // Handshake stage time histograms
+    uint32_t statBytes[STAT_ADDRS];             // Bytes transferred per address
+    uint16_t statTmo[STAT_ADDRS];               // Timeouts per address
+    uint16_t statAbort[STAT_ADDRS];             // Aborted transfers per address
+#endif
+
+#ifdef USE_HS488
+    bool hs488 = false;       // Use the HS488 handshake when all listeners support it
+    uint8_t hsPulse = 10;     // DAV pulse width in microseconds
+    uint32_t hsTalkers = 0;   // Talkers known to support HS488 (bit per address, HS_ANY_TALKER = any)
+    uint32_t hsBytes = 0;     // Bytes transferred with the HS488 handshake
+    uint16_t hsFallback = 0;  // Transfers that fell back to the interlocked handshake
+#endif
+
     GPIBbus();
 
     void begin();
@@ -150,14 +221,23 @@ class GPIBbus {
     void sendStatus();
 
     void setStatus(uint8_t statusByte);
+    void setSrq(bool state);
     bool sendCmd(uint8_t cmdByte);
-    uint8_t readByte(uint8_t *db, bool readWithEoi, bool *eoi);
+    uint8_t readByte(uint8_t *db, bool readWithEoi, bool *eoi, uint32_t tmo = 0);
     uint8_t writeByte(uint8_t db, bool isLastByte);
     bool receiveData(Stream& dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte);
+    void setTermEor();
+    bool setTermSeq(uint8_t *seq, uint8_t len);
+    void setTermSet(uint8_t bitmap[32]);
+    uint8_t getTermType();
+    uint8_t getTermSeq(uint8_t *seq);
+    bool isTermByte(uint8_t db);
     void sendData(char *data, uint8_t dsize);
     void clearDataBus();
     void setControlVal(uint8_t value, uint8_t mask, uint8_t mode);
     void setDataVal(uint8_t);
+    void setT1(uint8_t addr, uint16_t ns);
+    uint32_t getT1(uint8_t addr);
 
 //    void setDeviceAddressedState(uint8_t stat);
     bool isDeviceAddressedToListen();
@@ -166,6 +246,10 @@ class GPIBbus {
 
     void signalBreak();
 
+#ifdef USE_STATS
+    void statsClear();
+#endif
+
     bool addressDevice(uint8_t addr, bool dir);
     bool unAddressDevice();
     bool haveAddressedDevice();
@@ -173,14 +257,52 @@ class GPIBbus {
   private:
 
     bool deviceAddressed;
+    uint8_t lsnAddr;                // Instrument last addressed to listen (0xFF = none)
 //    uint8_t deviceAddressedState;
     
 //    bool writeByteHandshake(uint8_t db);
 //    boolean waitOnPinState(uint8_t state, uint8_t pin, int interval);
-    bool isTerminatorDetected(uint8_t bytes[3], uint8_t eorSequence);
+    uint8_t termType;               // Terminator type (TERM_EOR, TERM_SEQ or TERM_SET)
+    uint8_t termSeq[TERM_MAXLEN];   // Terminator sequence
+    uint8_t termNext[TERM_MAXLEN];  // Length of matched prefix to fall back to on mismatch
+    uint8_t termLen;                // Length of terminator sequence
+    uint8_t termMatch;              // Number of sequence bytes matched so far
+    uint8_t termSet[32];            // Bitmap of single byte terminators
+    uint16_t t1Delay[T1_ADDRS];     // Data settling delay count per address
+    uint16_t t1Max;                 // Longest delay count (commands and device mode)
+
+    uint16_t t1Count();
+    void settleDelay(uint16_t count);
+
+#ifdef USE_STATS
+    void statTime(uint8_t stage, uint32_t us);
+    void statXfer(uint8_t addr, uint16_t bytes, uint8_t flags);
+#endif
+
+#ifdef USE_HS488
+    uint8_t hsState = HS_OFF;       // Handshake state of the current transfer
+    bool hsTalker();
+    void hsCheck();
+    uint8_t readByteHs(uint8_t *db, bool readWithEoi, bool *eoi, uint32_t tmo);
+    uint8_t writeByteHs(uint8_t db, bool isLastByte);
+#endif
+
+    void setTermEorSeq(uint8_t eorSequence);
+    void buildTermTable();
+    bool isTerminatorDetected(uint8_t db);
     void setSrqSig();
     void clrSrqSig();
 
+#ifdef SN7516X
+    uint8_t snPin[3];               // SN7516x TE, DC and SC pins (0xFF = unused)
+#ifdef __AVR__
+    volatile uint8_t *snReg[3];     // Output register of each pin
+    uint8_t snBit[3];               // Port bit mask of each pin
+#endif
+    void snInit();
+    void snWrite(uint8_t sig, uint8_t state);
+#endif
+
     // Interrupt flag for MCP23S17
 #if defined(AR488_MCP23S17) || defined(AR488_MCP23017)
 //    extern volatile bool mcpIntA;  // MCP23x17 interrupt handler
@@ -190,4 +312,13 @@ class GPIBbus {
 };
 
 
+#if not defined(AR488_MCP23S17) && not defined(AR488_MCP23017)
+/***** Detect selected pin state *****/
+// Inlined so that the layout can reduce each check to a port bit test
+inline bool GPIBbus::isAsserted(uint8_t gpibsig){
+  return (getGpibPinState(gpibsig) == LOW) ? true : false;
+}
+#endif
+
+
 #endif // AR488_GPIBbus_H
@@ -192,6 +192,25 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** vvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_MEGA2560_E1
 
+/***** Data bus bit mapping tables *****/
+/*
+ * The data lines are interleaved across PORTA (bits 6,4,2,0) and PORTC
+ * (bits 7,5,3,1). Reading combines both ports into one byte and maps each
+ * nibble through a table; writing does the reverse.
+ */
+static const uint8_t dbRdLo[16] PROGMEM = {  // Port bits 0-3 to data bits
+  0x00, 0x10, 0x08, 0x18, 0x20, 0x30, 0x28, 0x38, 0x04, 0x14, 0x0C, 0x1C, 0x24, 0x34, 0x2C, 0x3C
+};
+static const uint8_t dbRdHi[16] PROGMEM = {  // Port bits 4-7 to data bits
+  0x00, 0x40, 0x02, 0x42, 0x80, 0xC0, 0x82, 0xC2, 0x01, 0x41, 0x03, 0x43, 0x81, 0xC1, 0x83, 0xC3
+};
+static const uint8_t dbWrLo[16] PROGMEM = {  // Data bits 0-3 to port bits
+  0x00, 0x80, 0x20, 0xA0, 0x08, 0x88, 0x28, 0xA8, 0x02, 0x82, 0x22, 0xA2, 0x0A, 0x8A, 0x2A, 0xAA
+};
+static const uint8_t dbWrHi[16] PROGMEM = {  // Data bits 4-7 to port bits
+  0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15, 0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55
+};
+
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
   // Set data pins to input
@@ -205,29 +224,15 @@ void readyGpibDbus() {
 
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
-  uint8_t db = 0;
-  uint8_t val = 0;
-
   // Read the byte of data on the bus (GPIB states are inverted)
-  val = ~((PINA & 0b01010101) + (PINC & 0b10101010));
-
-  db |= (((val >> 1) & 1)<<3);
-  db |= (((val >> 3) & 1)<<2);
-  db |= (((val >> 5) & 1)<<1);
-  db |= (((val >> 7) & 1)<<0);
-
-  db |= (((val >> 6) & 1)<<7);
-  db |= (((val >> 4) & 1)<<6);
-  db |= (((val >> 2) & 1)<<5);
-  db |= (((val >> 0) & 1)<<4);
-
-  return db;
+  uint8_t val = (PINA & 0b01010101) + (PINC & 0b10101010);
+  return ~( pgm_read_byte(&dbRdLo[val & 0x0F]) | pgm_read_byte(&dbRdHi[val >> 4]) );
 }
 
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  uint8_t val = 0;
+  uint8_t val;
   
   // Set data pins as outputs
   DDRA |= 0b01010101 ;
@@ -236,15 +241,7 @@ void setGpibDbus(uint8_t db) {
   // GPIB states are inverted
   db = ~db;
 
-  val |= (((db >> 3) & 1)<<1);
-  val |= (((db >> 2) & 1)<<3);
-  val |= (((db >> 1) & 1)<<5);
-  val |= (((db >> 0) & 1)<<7);
-
-  val |= (((db >> 7) & 1)<<6);
-  val |= (((db >> 6) & 1)<<4);
-  val |= (((db >> 5) & 1)<<2);
-  val |= (((db >> 4) & 1)<<0);
+  val = pgm_read_byte(&dbWrLo[db & 0x0F]) | pgm_read_byte(&dbWrHi[db >> 4]);
 
   // Set data bus
   PORTA = (PORTA & ~0b01010101) | (val & 0b01010101);
@@ -326,6 +323,24 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** vvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_MEGA2560_E2
 
+/***** Data bus bit mapping tables *****/
+/*
+ * As layout E1 but with the ports swapped: PORTA bits 7,5,3,1 and PORTC
+ * bits 6,4,2,0.
+ */
+static const uint8_t dbRdLo[16] PROGMEM = {  // Port bits 0-3 to data bits
+  0x00, 0x08, 0x10, 0x18, 0x04, 0x0C, 0x14, 0x1C, 0x20, 0x28, 0x30, 0x38, 0x24, 0x2C, 0x34, 0x3C
+};
+static const uint8_t dbRdHi[16] PROGMEM = {  // Port bits 4-7 to data bits
+  0x00, 0x02, 0x40, 0x42, 0x01, 0x03, 0x41, 0x43, 0x80, 0x82, 0xC0, 0xC2, 0x81, 0x83, 0xC1, 0xC3
+};
+static const uint8_t dbWrLo[16] PROGMEM = {  // Data bits 0-3 to port bits
+  0x00, 0x40, 0x10, 0x50, 0x04, 0x44, 0x14, 0x54, 0x01, 0x41, 0x11, 0x51, 0x05, 0x45, 0x15, 0x55
+};
+static const uint8_t dbWrHi[16] PROGMEM = {  // Data bits 4-7 to port bits
+  0x00, 0x02, 0x08, 0x0A, 0x20, 0x22, 0x28, 0x2A, 0x80, 0x82, 0x88, 0x8A, 0xA0, 0xA2, 0xA8, 0xAA
+};
+
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
 
@@ -340,29 +355,15 @@ void readyGpibDbus() {
 
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
-  uint8_t db = 0;
-  uint8_t val = 0;
-  
   // Read the byte of data on the bus (GPIB states are inverted)
-  val = ~((PINA & 0b10101010) + (PINC & 0b01010101));
-
-  db |= (((val >> 0) & 1)<<3);
-  db |= (((val >> 2) & 1)<<2);
-  db |= (((val >> 4) & 1)<<1);
-  db |= (((val >> 6) & 1)<<0);
-
-  db |= (((val >> 7) & 1)<<7);
-  db |= (((val >> 5) & 1)<<6);
-  db |= (((val >> 3) & 1)<<5);
-  db |= (((val >> 1) & 1)<<4);
-
-  return db;
+  uint8_t val = (PINA & 0b10101010) + (PINC & 0b01010101);
+  return ~( pgm_read_byte(&dbRdLo[val & 0x0F]) | pgm_read_byte(&dbRdHi[val >> 4]) );
 }
 
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  uint8_t val = 0;
+  uint8_t val;
   
   // Set data pins as outputs
   DDRA |= 0b10101010 ;
@@ -371,15 +372,7 @@ void setGpibDbus(uint8_t db) {
   // GPIB states are inverted
   db = ~db;
 
-  val |= (((db >> 4) & 1)<<1);
-  val |= (((db >> 5) & 1)<<3);
-  val |= (((db >> 6) & 1)<<5);
-  val |= (((db >> 7) & 1)<<7);
-
-  val |= (((db >> 0) & 1)<<6);
-  val |= (((db >> 1) & 1)<<4);
-  val |= (((db >> 2) & 1)<<2);
-  val |= (((db >> 3) & 1)<<0);
+  val = pgm_read_byte(&dbWrLo[db & 0x0F]) | pgm_read_byte(&dbWrHi[db >> 4]);
 
   // Set data bus
   PORTA = (PORTA & ~0b10101010) | (val & 0b10101010);
@@ -582,6 +575,25 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** vvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_MEGA32U4_LR3
 
+/***** Data bus bit mapping tables *****/
+/*
+ * Data bits 0-5 sit on PORTF bits 7,6,5,4,1,0 in reverse order. Each nibble
+ * of PINF (or of the data byte) is mapped through a table rather than
+ * shifted and bit-reversed on every transfer.
+ */
+static const uint8_t dbRdLo[16] PROGMEM = {  // PINF bits 0-1 to data bits 5-4
+  0x00, 0x20, 0x10, 0x30, 0x00, 0x20, 0x10, 0x30, 0x00, 0x20, 0x10, 0x30, 0x00, 0x20, 0x10, 0x30
+};
+static const uint8_t dbRdHi[16] PROGMEM = {  // PINF bits 4-7 to data bits 3-0
+  0x00, 0x08, 0x04, 0x0C, 0x02, 0x0A, 0x06, 0x0E, 0x01, 0x09, 0x05, 0x0D, 0x03, 0x0B, 0x07, 0x0F
+};
+static const uint8_t dbWrLo[16] PROGMEM = {  // Data bits 0-3 to PORTF bits 7-4
+  0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0
+};
+static const uint8_t dbWrHi[4] PROGMEM = {   // Data bits 4-5 to PORTF bits 1-0
+  0x00, 0x02, 0x01, 0x03
+};
+
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
   // Set data pins to input
@@ -599,7 +611,8 @@ void readyGpibDbus() {
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
   // Read the byte of data on the bus
-  uint8_t portf = reverseBits( (PINF & 0b11110000) + ((PINF & 0b00000011) << 2) );
+  uint8_t pinf = PINF;
+  uint8_t portf = pgm_read_byte(&dbRdLo[pinf & 0x0F]) | pgm_read_byte(&dbRdHi[pinf >> 4]);
   return ~( ((PIND & 0b00010000) << 2) + ((PINC & 0b01000000) <<1) + portf );
 }
 
@@ -617,7 +630,7 @@ void setGpibDbus(uint8_t db) {
   db = ~db;
 
   // Port F require bits mapped to 0-1 and 4-7 in reverse order
-  portf = reverseBits((db & 0b00001111) + ((db & 0b00110000) << 2));
+  portf = pgm_read_byte(&dbWrLo[db & 0x0F]) | pgm_read_byte(&dbWrHi[(db >> 4) & 0x03]);
 
   // Set data bus
   PORTC = (PORTC & ~0b01000000) | ((db & 0b10000000) >> 1);
@@ -676,13 +689,6 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 }
 
 
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
-
 #endif //AR488_MEGA32U4_LR3
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** LEONARDO R3 BOARD LAYOUT *****/
@@ -701,17 +707,46 @@ const uint8_t chipSelect = MCP_SELECTPIN;
 const uint8_t mcpAddr = MCP_ADDRESS;      // Must be between 0 and 7
 uint8_t mcpIntAReg = 0;
 
+// Shadow copies of the direction and output latch registers
+uint8_t mcpDirA = 0xFF;
+uint8_t mcpDirB = 0xFF;
+uint8_t mcpOlatA = 0x00;
+
+// Chip select port register and bit
+#ifdef __AVR__
+volatile uint8_t *mcpCsReg;
+uint8_t mcpCsBit;
+#define MCP_SELECT()    (*mcpCsReg &= ~mcpCsBit)
+#define MCP_DESELECT()  (*mcpCsReg |= mcpCsBit)
+#else
+#define MCP_SELECT()    digitalWrite(chipSelect, LOW)
+#define MCP_DESELECT()  digitalWrite(chipSelect, HIGH)
+#endif
+
 
 /***** Ready the SPI bus *****/
 void mcpInit(){
+#ifdef __AVR__
+  mcpCsReg = portOutputRegister(digitalPinToPort(chipSelect));
+  mcpCsBit = digitalPinToBitMask(chipSelect);
+#endif
   SPI.begin();
-  // Optional: Clock divider (slow down the bus speed [optional])
-  SPI.setClockDivider(SPI_CLOCK_DIV8);
+  // Clock divider - the MCP23S17 supports up to 10MHz so run at the fastest
+  // rate the board allows (F_CPU/2)
+  SPI.setClockDivider(SPI_CLOCK_DIV2);
   // Set expander configuration register
   // (Bit 1=0 sets active low for Int A)
   // (Bit 3=1 enables hardware address pins (MCP23S17 only)
+  // (Bit 5=0 enables sequential operation (register address increments)
   // (Bit 7=0 sets registers to be in same bank)
   mcpByteWrite(MCPCON, 0b00001000);
+  // Both ports to input with data bus pullups enabled
+  mcpWordWrite(MCPDIRA, 0b11111111, 0b11111111);
+  mcpWordWrite(MCPPUA, 0b00000000, 0b11111111);
+  mcpDirA = 0xFF;
+  mcpDirB = 0xFF;
+  // Load output latch shadow
+  mcpOlatA = mcpByteRead(MCPOLATA);
   // Enable MCP23S17 interrupts
   mcpInterruptsEn();
 }
@@ -720,9 +755,11 @@ void mcpInit(){
 
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
-  // Set data pins to input
-  mcpByteWrite(MCPDIRB, 0b11111111);  // Port direction: 0 = output; 1 = input;
-  mcpByteWrite(MCPPUB, 0b11111111);   // 1 = Pullup resistors enabled
+  // Set data pins to input (pullups were enabled by mcpInit)
+  if (mcpDirB != 0b11111111) {
+    mcpDirB = 0b11111111;
+    mcpByteWrite(MCPDIRB, mcpDirB);  // Port direction: 0 = output; 1 = input;
+  }
 }
 
 
@@ -736,7 +773,10 @@ uint8_t readGpibDbus() {
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
   // Set data pins as outputs
-  mcpByteWrite(MCPDIRB, 0b00000000);  // Port direction: 0 = output; 1 = input;
+  if (mcpDirB != 0b00000000) {
+    mcpDirB = 0b00000000;
+    mcpByteWrite(MCPDIRB, mcpDirB);  // Port direction: 0 = output; 1 = input;
+  }
 
   // GPIB states are inverted
   db = ~db;
@@ -761,34 +801,36 @@ void setGpibDbus(uint8_t db) {
    REN   5   PORTA bit 5 byte bit 5
    SRQ   6   PORTA bit 6 byte bit 6
    ATN   7   PORTA bit 7 byte bit 7
+
+   The port registers are not read back. Changes are applied to the shadow
+   copies and only written to the chip when the value actually changes.
 */
 
 void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 
-  uint8_t portAb = bits;
-  uint8_t portAm = mask;
-
-  uint8_t regByte = 0;
   uint8_t regMod = 0; 
 
-
   // Set registers: register = (register & ~bitmask) | (value & bitmask)
   // Mask: 0=unaffected; 1=to be changed
 
   switch (mode) {
     case 0:
-
       // Set pin states using mask
-      regByte = mcpByteRead(MCPPORTA);
-      regMod = (regByte & ~portAm) | (portAb & portAm);
-      mcpByteWrite(MCPPORTA, regMod);
+      regMod = (mcpOlatA & ~mask) | (bits & mask);
+      if (regMod != mcpOlatA) {
+        mcpOlatA = regMod;
+        mcpByteWrite(MCPPORTA, regMod);
+      }
       break;
 
     case 1:
       // Set pin direction registers using mask
-      regByte = ~mcpByteRead(MCPDIRA);   // Note: on MCP23S17 0 = output, 1 = input
-      regMod = (regByte & ~portAm) | (portAb & portAm);
-      mcpByteWrite(MCPDIRA, ~regMod);    // Note: on MCP23S17 0 = output, 1 = input
+      // Note: on MCP23S17 0 = output, 1 = input
+      regMod = ~((~mcpDirA & ~mask) | (bits & mask));
+      if (regMod != mcpDirA) {
+        mcpDirA = regMod;
+        mcpByteWrite(MCPDIRA, regMod);
+      }
       break;
 
   }
@@ -817,34 +859,38 @@ uint8_t getMcpIntAReg(){
  */
 uint8_t mcpByteRead(uint8_t reg){
   uint8_t db;
-//Serial.print(F("Rx addr: "));
-//Serial.print(mcpAddr);
-  digitalWrite(chipSelect, LOW);            // Enable MCP communication
+  MCP_SELECT();                             // Enable MCP communication
   SPI.transfer(MCPREAD | (mcpAddr << 1));   // Write opcode + chip address + write bit
   SPI.transfer(reg);                        // Write the register we want to read
   db = SPI.transfer(0x00);                  // Send any byte. Function returns low byte (port A value) which is ignored
-  digitalWrite(chipSelect, HIGH);           // Enable MCP communication
-//uint8_t dbinv = ~db;
-//Serial.print(F("\tRCV: "));
-//Serial.println(dbinv, HEX);
+  MCP_DESELECT();                           // Stop MCP communication
   return db;
 }
 
 
 /***** Write to the MCP23S17 *****/
 void mcpByteWrite(uint8_t reg, uint8_t db){
-//Serial.print(F("Tx addr: "));
-//Serial.print(mcpAddr);
-  digitalWrite(chipSelect, LOW);            // Enable MCP communication
+  MCP_SELECT();                             // Enable MCP communication
   SPI.transfer(MCPWRITE | (mcpAddr << 1));  // Write opcode (with write bit set) + chip address
   SPI.transfer(reg);                        // Write register we want to change
   SPI.transfer(db);                         // Write data byte
-  digitalWrite(chipSelect, HIGH);           // Stop MCP communication
-//Serial.print(F("\tWRT: "));
-//Serial.print(db, HEX);
-//uint8_t dbinv = ~db;
-//Serial.print(F("\tWRTinv: "));
-//Serial.println(dbinv, HEX);
+  MCP_DESELECT();                           // Stop MCP communication
+}
+
+
+/***** Write a port A register and its port B pair in one transaction *****/
+/*
+ * reg : port A register, e.g. MCPDIRA. With IOCON.BANK=0 and sequential
+ * operation enabled the chip advances to the port B register after the
+ * first data byte.
+ */
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb){
+  MCP_SELECT();                             // Enable MCP communication
+  SPI.transfer(MCPWRITE | (mcpAddr << 1));  // Write opcode (with write bit set) + chip address
+  SPI.transfer(reg);                        // Write port A register address
+  SPI.transfer(dba);                        // Port A data byte
+  SPI.transfer(dbb);                        // Port B data byte
+  MCP_DESELECT();                           // Stop MCP communication
 }
 
 
@@ -888,28 +934,60 @@ void mcpInterruptsEn(){
 /***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_MCP23017
 
-//uint8_t mcpPinAssertedReg = 0;
-uint8_t mcpIntAReg = 0;
-
-
 // MCP23017 hardware config
 //const uint8_t chipSelect = MCP_SELECTPIN;
 const uint8_t mcpHwAddr = MCP_ADDRESS;        // MCP hardware address (must be between 0 and 7)
 const uint8_t mcpI2Caddr = 0x20 | mcpHwAddr;  // MCP I2C address
 
+// Shadow copies of the direction and output latch registers
+uint8_t mcpDirA = 0xFF;
+uint8_t mcpDirB = 0xFF;
+uint8_t mcpOlatA = 0x00;
+
+// Last port A pin state read from the chip and when it was read
+uint8_t mcpPortA = 0xFF;
+uint32_t mcpPortATime = 0;
+
 
 /***** Arduino interrput handler *****/
 /*
  * Signals that IntA was asserted on the MCP chip
  */
-bool mcpIntA = false;
+volatile bool mcpIntA = true;
+
+
+/***** Ready the I2C bus *****/
+void mcpInit(){
+  // Start I2C
+  Wire.begin();
+  // Set the I2C bus clock frequency (see MCP_I2C_CLOCK in the config)
+  Wire.setClock(MCP_I2C_CLOCK);
+  // Set expander configuration register
+  // (Bit 1=0 sets active low for Int A)
+  // (Bit 3 is not relevant for the 23017)
+  // (Bit 5=0 enables sequential operation (register address increments)
+  // (Bit 7=0 sets registers to be in same bank)
+  mcpByteWrite(MCPCON, 0b00000000);
+  // Both ports to input with data bus pullups enabled
+  mcpWordWrite(MCPDIRA, 0b11111111, 0b11111111);
+  mcpWordWrite(MCPPUA, 0b00000000, 0b11111111);
+  mcpDirA = 0xFF;
+  mcpDirB = 0xFF;
+  // Load output latch shadow
+  mcpOlatA = mcpByteRead(MCPOLATA);
+  // Enable MCP23017 interrupts
+  mcpInterruptsEn();
+  mcpIntA = true;
+}
 
 
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
-  // Set data pins to input
-  mcpByteWrite(MCPDIRB, 0b11111111);  // Port direction: 0 = output; 1 = input;
-  mcpByteWrite(MCPPUB, 0b11111111);   // 1 = Pullup resistors enabled
+  // Set data pins to input (pullups were enabled by mcpInit)
+  if (mcpDirB != 0b11111111) {
+    mcpDirB = 0b11111111;
+    mcpByteWrite(MCPDIRB, mcpDirB);  // Port direction: 0 = output; 1 = input;
+  }
 }
 
 
@@ -923,7 +1001,10 @@ uint8_t readGpibDbus() {
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
   // Set data pins as outputs
-  mcpByteWrite(MCPDIRB, 0b00000000);  // Port direction: 0 = output; 1 = input;
+  if (mcpDirB != 0b00000000) {
+    mcpDirB = 0b00000000;
+    mcpByteWrite(MCPDIRB, mcpDirB);  // Port direction: 0 = output; 1 = input;
+  }
 
   // GPIB states are inverted
   db = ~db;
@@ -939,7 +1020,7 @@ void setGpibDbus(uint8_t db) {
     bits (databits) : State - 0=LOW, 1=HIGH/INPUT_PULLUP; Direction - 0=input, 1=output;
     mask (mask)     : 0=unaffected, 1=enabled
     mode (mode)     : 0=set pin state, 1=set pin direction
-   MCP23S17 pin to Port/bit to direction/state byte map:
+   MCP23017 pin to Port/bit to direction/state byte map:
    IFC   0   PORTA bit 0 byte bit 0
    NDAC  1   PORTA bit 1 byte bit 1
    NRFD  2   PORTA bit 2 byte bit 2
@@ -948,33 +1029,36 @@ void setGpibDbus(uint8_t db) {
    REN   5   PORTA bit 5 byte bit 5
    SRQ   6   PORTA bit 6 byte bit 6
    ATN   7   PORTA bit 7 byte bit 7
+
+   The port registers are not read back. Changes are applied to the shadow
+   copies and only written to the chip when the value actually changes.
 */
 
 void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 
-  uint8_t portAb = bits;
-  uint8_t portAm = mask;
-
-  uint8_t regByte = 0;
   uint8_t regMod = 0; 
 
-
   // Set registers: register = (register & ~bitmask) | (value & bitmask)
   // Mask: 0=unaffected; 1=to be changed
 
   switch (mode) {
     case 0:
       // Set pin states using mask
-      regByte = mcpByteRead(MCPPORTA);
-      regMod = (regByte & ~portAm) | (portAb & portAm);
-      mcpByteWrite(MCPPORTA, regMod);
+      regMod = (mcpOlatA & ~mask) | (bits & mask);
+      if (regMod != mcpOlatA) {
+        mcpOlatA = regMod;
+        mcpByteWrite(MCPPORTA, regMod);
+      }
       break;
 
     case 1:
       // Set pin direction registers using mask
-      regByte = ~mcpByteRead(MCPDIRA);   // Note: on MCP23S17 0 = output, 1 = input
-      regMod = (regByte & ~portAm) | (portAb & portAm);
-      mcpByteWrite(MCPDIRA, ~regMod);    // Note: on MCP23S17 0 = output, 1 = input
+      // Note: on MCP23017 0 = output, 1 = input
+      regMod = ~((~mcpDirA & ~mask) | (bits & mask));
+      if (regMod != mcpDirA) {
+        mcpDirA = regMod;
+        mcpByteWrite(MCPDIRA, regMod);
+      }
       break;
 
   }
@@ -984,17 +1068,28 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** MCP23017 interrupt handler *****/
 /*
  * Interrput pin on Arduino configure with attachInterrupt
+ * The I2C bus cannot be used inside an interrupt handler, so only flag
+ * that a port A pin has changed. The pins are read on the next request.
  */
 void mcpIntHandler() {
-//  mcpIntA = true;
-//  mcpPinAssertedReg = 0;
-//  Serial.println(F("MCP Interrupt triggered"));
-  mcpIntAReg = mcpByteRead(MCPINTCAPA);
+  mcpIntA = true;
 }
 
 
+/***** Return the port A pin states *****/
+/*
+ * Port A is only read over I2C when INTA has signalled a change since the
+ * last read (reading GPIOA also clears the interrupt) or when the cached
+ * value is older than MCP_REFRESH_US. While waiting on a handshake line
+ * that has not changed no bus traffic is generated.
+ */
 uint8_t getMcpIntAReg(){
-  return mcpIntAReg;
+  if (mcpIntA || ((micros() - mcpPortATime) > MCP_REFRESH_US)) {
+    mcpIntA = false;
+    mcpPortA = mcpByteRead(MCPPORTA);
+    mcpPortATime = micros();
+  }
+  return mcpPortA;
 }
 
 
@@ -1022,35 +1117,35 @@ static inline uint8_t wirerecv(TwoWire *theWire) {
  * reg : register we want to read , e.g. MCPPORTA or MCPPORTB
  */
 uint8_t mcpByteRead(uint8_t reg){
-  uint8_t db = 0;
   Wire.beginTransmission(mcpI2Caddr);
-Serial.print(F("Rx addr: "));
-Serial.print(mcpI2Caddr, HEX);
   wiresend(reg, &Wire);
   Wire.endTransmission();
   Wire.requestFrom(mcpI2Caddr, (uint8_t)1);
-  db = wirerecv(&Wire);
-uint8_t dbinv = ~db;
-Serial.print(F("\tRCV: "));
-Serial.println(dbinv, HEX);
-//  return wirerecv(&Wire);
-  return db;
+  return wirerecv(&Wire);
 }
 
 
 /***** Write to the MCP23017 *****/
 void mcpByteWrite(uint8_t reg, uint8_t db){
-Serial.print(F("Tx addr: "));
-Serial.print(mcpI2Caddr, HEX);
   Wire.beginTransmission(mcpI2Caddr);
   wiresend(reg, &Wire);
   wiresend(db, &Wire);
   Wire.endTransmission();
-Serial.print(F("\tWRT: "));
-Serial.print(db, HEX);
-uint8_t dbinv = ~db;
-Serial.print(F("\tWRTinv: "));
-Serial.println(dbinv, HEX);
+}
+
+
+/***** Write a port A register and its port B pair in one transaction *****/
+/*
+ * reg : port A register, e.g. MCPDIRA. With IOCON.BANK=0 and sequential
+ * operation enabled the chip advances to the port B register after the
+ * first data byte.
+ */
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb){
+  Wire.beginTransmission(mcpI2Caddr);
+  wiresend(reg, &Wire);
+  wiresend(dba, &Wire);
+  wiresend(dbb, &Wire);
+  Wire.endTransmission();
 }
 
 
@@ -1063,8 +1158,8 @@ uint8_t mcpDigitalRead(uint8_t pin) {
   // If the pin value is larger than 7 then do nothing and return
   // Zero or larger value is implied by the variable type
   if (pin > 7) return 0x0;
-  // Read the port A pin state, extract and return HIGH/LOW state for the requested pin
-  return mcpByteRead(MCPPORTA) & (1 << pin) ? HIGH : LOW;
+  // Get the port A pin state, extract and return HIGH/LOW state for the requested pin
+  return getMcpIntAReg() & (1 << pin) ? HIGH : LOW;
 }
 
 
@@ -1078,8 +1173,9 @@ uint8_t getGpibPinState(uint8_t pin){
 void mcpInterruptsEn(){
   // Set to interrupt mode for compare to previous
   mcpByteWrite(MCPINTCONA, 0b00000000);
-  // Enable interrupt to detect pin state change on pins 4, 6 and 7 (EOI, SRQ and ATN)
-  mcpByteWrite(MCPINTENA, 0b11010000);
+  // Enable interrupt to detect pin state change on all control pins
+  // (the handshake lines as well as EOI, SRQ and ATN)
+  mcpByteWrite(MCPINTENA, 0b11111111);
 }
 
 #endif //AR488_MCP23017
@@ -1127,13 +1223,11 @@ void setGpibDbus(uint8_t db) {
 }
 
 
-/***** Reverse the order of the bits in a byte *****/
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
+/***** Control bits 0-4 reversed onto PORTC bits 6-2 *****/
+static const uint8_t ctrlPortC[32] PROGMEM = {
+  0x00, 0x40, 0x20, 0x60, 0x10, 0x50, 0x30, 0x70, 0x08, 0x48, 0x28, 0x68, 0x18, 0x58, 0x38, 0x78,
+  0x04, 0x44, 0x24, 0x64, 0x14, 0x54, 0x34, 0x74, 0x0C, 0x4C, 0x2C, 0x6C, 0x1C, 0x5C, 0x3C, 0x7C
+};
 
 
 /***** Set the direction and state of the GPIB control lines ****/
@@ -1160,8 +1254,8 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 
   // PORT C- use the 5 right-most bits (bits 0 - 4) and bit 6
   // Reverse bits 0-4 and map to bits 2-6. Map bit 6 to bit 7
-  uint8_t portCb = (reverseBits(bits & 0x1F) >> 1) + ((bits & 0x40) << 1);
-  uint8_t portCm = (reverseBits(mask & 0x1F) >> 1) + ((mask & 0x40) << 1);
+  uint8_t portCb = pgm_read_byte(&ctrlPortC[bits & 0x1F]) + ((bits & 0x40) << 1);
+  uint8_t portCm = pgm_read_byte(&ctrlPortC[mask & 0x1F]) + ((mask & 0x40) << 1);
 
   // Set registers: register = (register & ~bitmask) | (value & bitmask)
   // Mask: 0=unaffected; 1=to be changed
@@ -1193,14 +1287,153 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_CUSTOM
 
-uint8_t databus[8] = { DIO1, DIO2, DIO3, DIO4, DIO5, DIO6, DIO7, DIO8 };
+const uint8_t databus[8] = { DIO1, DIO2, DIO3, DIO4, DIO5, DIO6, DIO7, DIO8 };
+
+const uint8_t ctrlbus[8] = { IFC, NDAC, NRFD, DAV, EOI, REN, SRQ, ATN };
+
+
+#ifdef __AVR__
+
+/***** Port register access for custom layouts *****/
+/*
+ * The pins of each bus are resolved into port registers and bit masks
+ * once, when the object is constructed, so that each bus operation reads
+ * or writes each port used only once rather than calling digitalRead()
+ * or digitalWrite() for every pin. The pin to port mapping of the core is
+ * held in PROGMEM tables that cannot be used in constant expressions, so
+ * this cannot be done by the compiler.
+ */
+CustomBus::CustomBus(const uint8_t pins[8]) {
+  uint8_t port;
+  uint8_t g;
+
+  ports = 0;
+  for (uint8_t i=0; i<8; i++) {
+    port = digitalPinToPort(pins[i]);
+    bit[i] = digitalPinToBitMask(pins[i]);
+    // Find the port or add it to the list
+    for (g=0; g<ports; g++) {
+      if (pinReg[g] == portInputRegister(port)) break;
+    }
+    if (g == ports) {
+      pinReg[g] = portInputRegister(port);
+      outReg[g] = portOutputRegister(port);
+      ddrReg[g] = portModeRegister(port);
+      ports++;
+    }
+    grp[i] = g;
+  }
+}
+
+
+/***** Read the state of the bus pins (bit set = HIGH) *****/
+uint8_t CustomBus::read() {
+  uint8_t val[8];
+  uint8_t db = 0;
+  for (uint8_t g=0; g<ports; g++) {
+    val[g] = *pinReg[g];
+  }
+  for (uint8_t i=0; i<8; i++) {
+    if (val[grp[i]] & bit[i]) db |= (1<<i);
+  }
+  return db;
+}
+
+
+/***** Collect the port bits to set and clear for masked bus bits *****/
+void CustomBus::split(uint8_t bits, uint8_t mask, uint8_t *set, uint8_t *clr) {
+  memset(set, 0, 8);
+  memset(clr, 0, 8);
+  for (uint8_t i=0; i<8; i++) {
+    if (mask & (1<<i)) {
+      if (bits & (1<<i)) {
+        set[grp[i]] |= bit[i];
+      }else{
+        clr[grp[i]] |= bit[i];
+      }
+    }
+  }
+}
+
+
+/***** Set the state of the masked pins (bit set = HIGH) *****/
+void CustomBus::setState(uint8_t bits, uint8_t mask) {
+  uint8_t set[8];
+  uint8_t clr[8];
+  uint8_t oldSREG = SREG;
+  split(bits, mask, set, clr);
+  cli();
+  for (uint8_t g=0; g<ports; g++) {
+    *outReg[g] = (*outReg[g] & ~clr[g]) | set[g];
+  }
+  SREG = oldSREG;
+}
+
+
+/***** Set the direction of the masked pins (bit set = OUTPUT, clear = INPUT_PULLUP) *****/
+void CustomBus::setDir(uint8_t bits, uint8_t mask) {
+  uint8_t set[8];
+  uint8_t clr[8];
+  uint8_t oldSREG = SREG;
+  split(bits, mask, set, clr);
+  cli();
+  for (uint8_t g=0; g<ports; g++) {
+    *ddrReg[g] = (*ddrReg[g] & ~clr[g]) | set[g];
+    *outReg[g] |= clr[g];
+  }
+  SREG = oldSREG;
+}
+
 
-uint8_t ctrlbus[8] = { IFC, NDAC, NRFD, DAV, EOI, REN, SRQ, ATN };
+CustomBus dataBus(databus);
+CustomBus ctrlBus(ctrlbus);
 
 
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
-  uint8_t db = 0;
+  dataBus.setDir(0x00, 0xFF);
+}
+
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+uint8_t readGpibDbus() {
+  return ~dataBus.read();
+}
+
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+void setGpibDbus(uint8_t db) {
+  dataBus.setDir(0xFF, 0xFF);
+  dataBus.setState(~db, 0xFF);
+}
+
+
+/***** Set the direction and state of the GPIB control lines ****/
+/*
+   Bits control lines as follows: 7-ATN, 6-SRQ, 5-REN, 4-EOI, 3-DAV, 2-NRFD, 1-NDAC, 0-IFC
+   state: 0=LOW; 1=HIGH/INPUT_PULLUP
+   dir  : 0=input; 1=output;
+   mode:  0=set pin state; 1=set pin direction
+*/
+void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
+
+  switch (mode) {
+    case 0:
+      // Set pin state
+      ctrlBus.setState(bits, mask);
+      break;
+    case 1:
+      // Set pin direction
+      ctrlBus.setDir(bits, mask);
+      break;
+  }
+
+}
+
+#else
+
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
   for (uint8_t i=0; i<8; i++){
     pinMode(databus[i], INPUT_PULLUP);
   }
@@ -1254,6 +1487,8 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 
 }
 
+#endif  // __AVR__
+
 #endif
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** CUSTOM PIN LAYOUT SECTION *****/
@@ -1266,7 +1501,7 @@ void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
 /***** COMMON FUNCTIONS SECTION *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvv *****/
 
-#if not defined(AR488_MCP23S17) && not defined(AR488_MCP23017)
+#if not defined(AR488_MCP23S17) && not defined(AR488_MCP23017) && not defined(IFC_STATE)
 uint8_t getGpibPinState(uint8_t pin){
   return digitalRead(pin);
 }
@@ -19,6 +19,25 @@
 /***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef AR488_CUSTOM
 
+#ifdef __AVR__
+/***** Bus of 8 arbitrary pins accessed through port registers *****/
+class CustomBus {
+  public:
+    CustomBus(const uint8_t pins[8]);
+    uint8_t read();
+    void setState(uint8_t bits, uint8_t mask);
+    void setDir(uint8_t bits, uint8_t mask);
+  private:
+    void split(uint8_t bits, uint8_t mask, uint8_t *set, uint8_t *clr);
+    uint8_t ports;                  // Number of ports used by the bus
+    volatile uint8_t *pinReg[8];    // Input register of each port
+    volatile uint8_t *outReg[8];    // Output register of each port
+    volatile uint8_t *ddrReg[8];    // Direction register of each port
+    uint8_t grp[8];                 // Port used by each bus bit
+    uint8_t bit[8];                 // Port bit mask of each bus bit
+};
+#endif
+
 /*
 // Use only pinhooks for custom mode
 // (We don't know which pin interrupts will be required)
@@ -61,6 +80,16 @@
 #define REN    3  /* GPIB 17 : PORTD bit 3 */
 #define ATN    7  /* GPIB 11 : PORTD bit 7 */
 
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINB & _BV(0))
+#define NDAC_STATE (PINB & _BV(1))
+#define NRFD_STATE (PINB & _BV(2))
+#define DAV_STATE  (PINB & _BV(3))
+#define EOI_STATE  (PINB & _BV(4))
+#define SRQ_STATE  (PIND & _BV(2))
+#define REN_STATE  (PIND & _BV(3))
+#define ATN_STATE  (PIND & _BV(7))
+
 
 #endif
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -94,6 +123,16 @@
 #define SRQ   10  /* GPIB 10 : PORTB bit 4 */
 #define ATN   11  /* GPIB 11 : PORTB bit 5 */
 
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINH & _BV(0))
+#define NDAC_STATE (PINH & _BV(1))
+#define NRFD_STATE (PINH & _BV(3))
+#define DAV_STATE  (PINH & _BV(4))
+#define EOI_STATE  (PINH & _BV(5))
+#define REN_STATE  (PINH & _BV(6))
+#define SRQ_STATE  (PINB & _BV(4))
+#define ATN_STATE  (PINB & _BV(5))
+
 #endif  // AR488_MEGA2560_D
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** MEGA2560 LAYOUT DEFINITION (Default) *****/
@@ -116,15 +155,25 @@
 #define DIO7  26  /* GPIB 15 : PORTA bit 2 */
 #define DIO8  28  /* GPIB 16 : PORTA bit 0 */
 
-#define IFC   48  /* GPIB 9  : PORTD bit 7 */
-#define NDAC  46  /* GPIB 8  : PORTG bit 1 */
-#define NRFD  44  /* GPIB 7  : PORTL bit 7 */
-#define DAV   42  /* GPIB 6  : PORTL bit 5 */
-#define EOI   40  /* GPIB 5  : PORTL bit 3 */
-#define REN   38  /* GPIB 17 : PORTL bit 1 */
-
-#define SRQ   50  /* GPIB 10 : PORTB bit 1 */
-#define ATN   52  /* GPIB 11 : PORTB bit 3 */
+#define IFC   48  /* GPIB 9  : PORTL bit 1 */
+#define NDAC  46  /* GPIB 8  : PORTL bit 3 */
+#define NRFD  44  /* GPIB 7  : PORTL bit 5 */
+#define DAV   42  /* GPIB 6  : PORTL bit 7 */
+#define EOI   40  /* GPIB 5  : PORTG bit 1 */
+#define REN   38  /* GPIB 17 : PORTD bit 7 */
+
+#define SRQ   50  /* GPIB 10 : PORTB bit 3 */
+#define ATN   52  /* GPIB 11 : PORTB bit 1 */
+
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINL & _BV(1))
+#define NDAC_STATE (PINL & _BV(3))
+#define NRFD_STATE (PINL & _BV(5))
+#define DAV_STATE  (PINL & _BV(7))
+#define EOI_STATE  (PING & _BV(1))
+#define REN_STATE  (PIND & _BV(7))
+#define SRQ_STATE  (PINB & _BV(3))
+#define ATN_STATE  (PINB & _BV(1))
 
 #endif  // AR488_MEGA2560_E1
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -148,15 +197,25 @@
 #define DIO7  25  /* GPIB 15 : PORTC bit 2 */
 #define DIO8  23  /* GPIB 16 : PORTC bit 0 */
 
-#define IFC   49  /* GPIB 9  : PORTG bit 0 */
-#define NDAC  47  /* GPIB 8  : PORTG bit 2 */
-#define NRFD  45  /* GPIB 7  : PORTL bit 6 */
-#define DAV   43  /* GPIB 6  : PORTL bit 4 */
-#define EOI   41  /* GPIB 5  : PORTL bit 2 */
-#define REN   39  /* GPIB 17 : PORTL bit 0 */
-
-#define SRQ   51  /* GPIB 10 : PORTB bit 0 */
-#define ATN   53  /* GPIB 11 : PORTB bit 2 */
+#define IFC   49  /* GPIB 9  : PORTL bit 0 */
+#define NDAC  47  /* GPIB 8  : PORTL bit 2 */
+#define NRFD  45  /* GPIB 7  : PORTL bit 4 */
+#define DAV   43  /* GPIB 6  : PORTL bit 6 */
+#define EOI   41  /* GPIB 5  : PORTG bit 0 */
+#define REN   39  /* GPIB 17 : PORTG bit 2 */
+
+#define SRQ   51  /* GPIB 10 : PORTB bit 2 */
+#define ATN   53  /* GPIB 11 : PORTB bit 0 */
+
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINL & _BV(0))
+#define NDAC_STATE (PINL & _BV(2))
+#define NRFD_STATE (PINL & _BV(4))
+#define DAV_STATE  (PINL & _BV(6))
+#define EOI_STATE  (PING & _BV(0))
+#define REN_STATE  (PING & _BV(2))
+#define SRQ_STATE  (PINB & _BV(2))
+#define ATN_STATE  (PINB & _BV(0))
 
 #endif  // AR488_MEGA2560_E2
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -188,6 +247,16 @@
 #define SRQ   7   /* GPIB 10 : PORTE bit 6 */
 #define ATN   2   /* GPIB 11 : PORTD bit 1 */
 
+/***** Control line input register bits *****/
+#define IFC_STATE  (PIND & _BV(4))
+#define NDAC_STATE (PINF & _BV(4))
+#define NRFD_STATE (PINF & _BV(5))
+#define DAV_STATE  (PINF & _BV(6))
+#define EOI_STATE  (PINF & _BV(7))
+#define REN_STATE  (PINC & _BV(6))
+#define SRQ_STATE  (PINE & _BV(6))
+#define ATN_STATE  (PIND & _BV(1))
+
 #endif  // AR488_MEGA32U4_MICRO
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** MICRO PRO (32u4) LAYOUT DEFINITION for MICRO (Artag) *****/
@@ -205,22 +274,30 @@
 #define DIO2  A1  /* GPIB 2  : PORTF bit 6 */
 #define DIO3  A2  /* GPIB 3  : PORTF bit 5 */
 #define DIO4  A3  /* GPIB 4  : PORTF bit 4 */
-#define DIO5  A4  /* GPIB 13 : PORTF bit 3 */
-#define DIO6  A5  /* GPIB 14 : PORTF bit 2 */
+#define DIO5  A4  /* GPIB 13 : PORTF bit 1 */
+#define DIO6  A5  /* GPIB 14 : PORTF bit 0 */
 #define DIO7   4  /* GPIB 15 : PORTD bit 4 */
 #define DIO8   5  /* GPIB 16 : PORTC bit 6 */
 
 #define IFC    8  /* GPIB 9  : PORTB bit 4 */
 #define NDAC   9  /* GPIB 8  : PORTB bit 5 */
 #define NRFD  10  /* GPIB 7  : PORTB bit 6 */
-#define DAV   11  /* GPIB 6  : PORTD bit 6 */
-#define EOI   12  /* GPIB 5  : PORTC bit 7 */
+#define DAV   11  /* GPIB 6  : PORTB bit 7 */
+#define EOI   12  /* GPIB 5  : PORTD bit 6 */
 
 #define SRQ    2  /* GPIB 10 : PORTD bit 1 */
 #define REN    3  /* GPIB 17 : PORTD bit 0 */
 #define ATN    7  /* GPIB 11 : PORTE bit 6 */
 
-uint8_t reverseBits(uint8_t dbyte);
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINB & _BV(4))
+#define NDAC_STATE (PINB & _BV(5))
+#define NRFD_STATE (PINB & _BV(6))
+#define DAV_STATE  (PINB & _BV(7))
+#define EOI_STATE  (PIND & _BV(6))
+#define SRQ_STATE  (PIND & _BV(1))
+#define REN_STATE  (PIND & _BV(0))
+#define ATN_STATE  (PINE & _BV(6))
 
 #endif // AR488_MEGA32U4_LR3
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -262,6 +339,10 @@ uint8_t reverseBits(uint8_t dbyte);
 #define MCPPORTA 0x12
 #define MCPPORTB 0x13
 
+// Output latch register
+#define MCPOLATA 0x14
+#define MCPOLATB 0x15
+
 // Interrupt registers
 #define MCPINTENA 0x04    // Enable pin for interrupt on change (GPINTEN)
 #define MCPINTCONA 0x08   // Configure interrupt: 0 = compare against previous; 1 = compare against DEFVAL
@@ -276,6 +357,7 @@ uint8_t reverseBits(uint8_t dbyte);
 void mcpInit();
 uint8_t mcpByteRead(uint8_t reg);
 void mcpByteWrite(uint8_t reg, uint8_t db);
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb);
 uint8_t mcpDigitalRead(uint8_t pin);
 void mcpInterruptsEn();
 void mcpIntHandler();
@@ -321,6 +403,10 @@ uint8_t getMcpIntAReg();
 #define MCPPORTA 0x12
 #define MCPPORTB 0x13
 
+// Output latch register
+#define MCPOLATA 0x14
+#define MCPOLATB 0x15
+
 // Interrupt registers
 #define MCPINTENA 0x04    // Enable pin for interrupt on change (GPINTEN)
 #define MCPINTCONA 0x08   // Configure interrupt: 0 = compare against previous; 1 = compare against DEFVAL
@@ -332,8 +418,10 @@ uint8_t getMcpIntAReg();
 #define MCPWRITE 0b01000000
 #define MCPREAD  0b01000001
 
+void mcpInit();
 uint8_t mcpByteRead(uint8_t reg);
 void mcpByteWrite(uint8_t reg, uint8_t db);
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb);
 uint8_t mcpDigitalRead(uint8_t pin);
 void mcpInterruptsEn();
 void mcpIntHandler();
@@ -370,6 +458,16 @@ uint8_t getMcpIntAReg();
 #define REN   24   /* GPIB 17 */
 #define ATN   31   /* GPIB 11 */
 
+/***** Control line input register bits *****/
+#define IFC_STATE  (PINC & _BV(6))
+#define NDAC_STATE (PINC & _BV(5))
+#define NRFD_STATE (PINC & _BV(4))
+#define DAV_STATE  (PINC & _BV(3))
+#define EOI_STATE  (PINC & _BV(2))
+#define SRQ_STATE  (PINC & _BV(7))
+#define REN_STATE  (PINA & _BV(0))
+#define ATN_STATE  (PINA & _BV(7))
+
 #endif // AR488_MEGA644P_MCGRAW
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** PANDUINO/MIGHTYCORE MCGRAW LAYOUT DEFINITION *****/
@@ -385,7 +483,29 @@ void readyGpibDbus();
 uint8_t readGpibDbus();
 void setGpibDbus(uint8_t db);
 void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode);
+
+#if defined(IFC_STATE) && not defined(AR488_MCP23S17) && not defined(AR488_MCP23017)
+/***** Read a control line directly from its port input register *****/
+/*
+ * Called with a constant pin the switch folds to a single bit test, so
+ * the handshake loops avoid the table lookups done by digitalRead().
+ */
+inline __attribute__((always_inline)) uint8_t getGpibPinState(uint8_t pin){
+  switch (pin) {
+    case IFC:  return IFC_STATE ? HIGH : LOW;
+    case NDAC: return NDAC_STATE ? HIGH : LOW;
+    case NRFD: return NRFD_STATE ? HIGH : LOW;
+    case DAV:  return DAV_STATE ? HIGH : LOW;
+    case EOI:  return EOI_STATE ? HIGH : LOW;
+    case REN:  return REN_STATE ? HIGH : LOW;
+    case SRQ:  return SRQ_STATE ? HIGH : LOW;
+    case ATN:  return ATN_STATE ? HIGH : LOW;
+  }
+  return digitalRead(pin);
+}
+#else
 uint8_t getGpibPinState(uint8_t pin);
+#endif
 
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** GLOBAL DEFINITIONS SECTION *****/
@@ -0,0 +1,76 @@
+/*
+ * Minimal Arduino core for building AR488_GPIBbus.cpp on the host.
+ * Time, delays and interrupts are provided by the bus simulation.
+ */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define ARDUINO 10800
+#define F(s) (s)
+#define PROGMEM
+#define DEC 10
+#define HEX 16
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define clockCyclesPerMicrosecond() 16
+
+class Print {
+public:
+  virtual size_t write(uint8_t data) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+  }
+  size_t print(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long val, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%ld", val);
+    return print(buf);
+  }
+  size_t println() { return print("\r\n"); }
+  template<typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long) {}
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  size_t write(uint8_t) { return 1; }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void noInterrupts();
+void interrupts();
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void pinMode(uint8_t pin, uint8_t mode);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * Simulation test for the HS488 handshake.
+ *
+ * Runs the GPIBbus send and receive code against a simulated HS488
+ * listener and talker. The bus lines, the data bus and the clock are
+ * simulated: every pin access and delay advances a virtual clock, and
+ * the simulated device is stepped as the clock runs. While interrupts
+ * are enabled, interrupt handlers of random length take time away from
+ * the interface. Runs on the host with the custom layout:
+ *
+ *   g++ -std=gnu++11 -I. -DAR488_CUSTOM -DUSE_HS488 \
+ *       hs488_test.cpp ../../AR488/AR488_GPIBbus.cpp -o hs488_test
+ *   ./hs488_test
+ */
+#include <Arduino.h>
+#include <string>
+#include "../../AR488/AR488_GPIBbus.h"
+
+HardwareSerial Serial;
+
+/***** Control line bits (as used by setGpibState) *****/
+#define B_IFC  0x01
+#define B_NDAC 0x02
+#define B_NRFD 0x04
+#define B_DAV  0x08
+#define B_EOI  0x10
+#define B_REN  0x20
+#define B_SRQ  0x40
+#define B_ATN  0x80
+
+#define STEP_NS 100         // Simulated device step
+#define PIN_NS 500          // Time taken by a pin access
+
+
+/**********************/
+/***** SIMULATION *****/
+/**********************/
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return ((seed >> 8) & 0xFFFFFF) % range;
+}
+
+static uint64_t simNs = 0;          // Virtual clock
+static bool intEnabled = true;      // Interface interrupts enabled
+static uint64_t isrDue = 0;         // Next interrupt of the interface
+static uint32_t isrMaxUs = 0;       // Longest interrupt handler (0 = none)
+
+static uint8_t ifDir = 0;           // Interface control line directions
+static uint8_t ifVal = 0xFF;        // Interface control line states
+static uint8_t ifData = 0;          // Interface data bus (1 = asserted)
+static uint8_t devLines = 0;        // Control lines asserted by the device
+static uint8_t devData = 0;         // Data bus driven by the device
+
+
+/***** Control lines asserted on the bus *****/
+static uint8_t busLines() {
+  return (ifDir & ~ifVal) | devLines;
+}
+
+static bool asserted(uint8_t bit) {
+  return (busLines() & bit) ? true : false;
+}
+
+static uint8_t busData() {
+  return ifData | devData;
+}
+
+
+/***** Simulated device *****/
+class SimDevice {
+public:
+  virtual void step() = 0;
+  std::string data;                 // Bytes received or left to send
+};
+
+static SimDevice *dev = NULL;
+
+
+/***** Advance the clock, running interrupts and the device *****/
+static void simAdvance(uint32_t ns) {
+  uint32_t left = ns;     // Time the interface itself runs for
+  while (left) {
+    if (isrMaxUs && intEnabled && (simNs >= isrDue)) {
+      // An interrupt handler runs and the interface stands still
+      uint64_t isrEnd = simNs + 1000ULL * (1 + rnd(isrMaxUs));
+      while (simNs < isrEnd) {
+        simNs += STEP_NS;
+        if (dev) dev->step();
+      }
+      isrDue = simNs + 1000ULL * (20 + rnd(600));
+    }
+    simNs += STEP_NS;
+    if (dev) dev->step();
+    left = (left > STEP_NS) ? left - STEP_NS : 0;
+  }
+}
+
+
+/***** Start a test with an idle bus *****/
+static void simReset(SimDevice *device, uint32_t isrUs) {
+  devLines = 0;
+  devData = 0;
+  ifData = 0;
+  intEnabled = true;
+  isrMaxUs = isrUs;
+  dev = device;
+}
+
+
+/***** Arduino core *****/
+unsigned long micros() {
+  simAdvance(PIN_NS);
+  return (unsigned long)(simNs / 1000);
+}
+
+unsigned long millis() {
+  simAdvance(PIN_NS);
+  return (unsigned long)(simNs / 1000000);
+}
+
+void delay(unsigned long ms) {
+  simAdvance(ms * 1000000UL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simAdvance(us * 1000UL);
+}
+
+void noInterrupts() {
+  intEnabled = false;
+}
+
+void interrupts() {
+  intEnabled = true;
+}
+
+int digitalRead(uint8_t) {
+  return HIGH;
+}
+
+void digitalWrite(uint8_t, uint8_t) {
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+
+/***** Layout functions *****/
+void readyGpibDbus() {
+  simAdvance(PIN_NS);
+  ifData = 0;
+}
+
+uint8_t readGpibDbus() {
+  simAdvance(PIN_NS);
+  return busData();
+}
+
+void setGpibDbus(uint8_t db) {
+  simAdvance(PIN_NS);
+  ifData = db;
+}
+
+void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
+  simAdvance(PIN_NS);
+  if (mode == 0) ifVal = (ifVal & ~mask) | (bits & mask);
+  if (mode == 1) ifDir = (ifDir & ~mask) | (bits & mask);
+}
+
+uint8_t getGpibPinState(uint8_t pin) {
+  uint8_t bit = 0;
+  simAdvance(PIN_NS);
+  switch (pin) {
+    case IFC:  bit = B_IFC;  break;
+    case NDAC: bit = B_NDAC; break;
+    case NRFD: bit = B_NRFD; break;
+    case DAV:  bit = B_DAV;  break;
+    case EOI:  bit = B_EOI;  break;
+    case REN:  bit = B_REN;  break;
+    case SRQ:  bit = B_SRQ;  break;
+    case ATN:  bit = B_ATN;  break;
+  }
+  return asserted(bit) ? LOW : HIGH;
+}
+
+
+/***** Simulated listener *****/
+/*
+ * Accepts the first byte of a message with the interlocked handshake.
+ * A HS488 listener then leaves NDAC unasserted and takes the following
+ * bytes the way readByteHs() does: NRFD is unasserted for a 200us
+ * window, DAV is watched for 20us after NRFD is asserted again, and
+ * between windows the listener is busy for a random time. EOI without
+ * DAV ends the message.
+ */
+class SimListener : public SimDevice {
+public:
+  SimListener(bool hs) : _hs(hs) { reset(); }
+
+  void step() {
+    bool dav = asserted(B_DAV);
+    if (_wait) {
+      _wait--;
+      return;
+    }
+    switch (_state) {
+      case READY:             // Interlocked: wait for DAV
+        release(B_NRFD);
+        if (dav) {
+          drive(B_NRFD);
+          data += (char)busData();
+          release(B_NDAC);
+          _state = ACCEPTED;
+        }
+        break;
+      case ACCEPTED:          // Interlocked: wait for the end of DAV
+        if (!dav) {
+          if (_hs) {
+            // Leave NDAC unasserted
+            _state = WINDOW;
+            _count = us(200);
+          } else {
+            drive(B_NDAC);
+            _state = READY;
+          }
+          _wait = us(2 + rnd(10));
+        }
+        break;
+      case WINDOW:            // HS488: NRFD unasserted
+        release(B_NRFD);
+        if (dav) {
+          take();
+        } else if (endOfMessage()) {
+          break;
+        } else if (--_count == 0) {
+          drive(B_NRFD);
+          _state = GUARD;
+          _count = us(20);
+        }
+        break;
+      case GUARD:             // HS488: NRFD asserted, DAV still watched
+        if (dav) {
+          take();
+        } else if (--_count == 0) {
+          // Busy until the next window
+          _state = WINDOW;
+          _count = us(200);
+          _wait = us(2 + rnd(60));
+        }
+        break;
+      case TAKEN:             // HS488: wait for the end of the DAV pulse
+        if (!dav) {
+          _state = WINDOW;
+          _count = us(200);
+          _wait = us(2 + rnd(20));
+        }
+        break;
+    }
+  }
+
+  void reset() {
+    devLines = B_NRFD | B_NDAC;
+    _state = READY;
+    _wait = us(20);
+    _count = 0;
+  }
+
+private:
+  enum { READY, ACCEPTED, WINDOW, GUARD, TAKEN };
+
+  static uint32_t us(uint32_t n) { return n * 1000 / STEP_NS; }
+  static void drive(uint8_t bit) { devLines |= bit; }
+  static void release(uint8_t bit) { devLines &= ~bit; }
+
+  void take() {
+    drive(B_NRFD);
+    data += (char)busData();
+    _state = TAKEN;
+  }
+
+  bool endOfMessage() {
+    if (!asserted(B_EOI)) return false;
+    // Back to the interlocked handshake for the next message
+    devLines = B_NRFD | B_NDAC;
+    _state = READY;
+    _wait = us(50 + rnd(100));
+    return true;
+  }
+
+  bool _hs;
+  uint8_t _state;
+  uint32_t _wait;         // Steps to stay busy
+  uint32_t _count;        // Steps left in a window or guard time
+};
+
+
+/***** Simulated talker *****/
+/*
+ * Sends the first byte with the interlocked handshake. A HS488 talker
+ * then sends the rest with a DAV pulse whenever NRFD and NDAC are both
+ * unasserted, as writeByteHs() does with interrupts disabled, and goes
+ * back to the interlocked handshake if NDAC is asserted. The last byte
+ * is sent with EOI.
+ */
+class SimTalker : public SimDevice {
+public:
+  SimTalker(bool hs) : _hs(hs), _pos(0), _state(IDLE), _wait(0) {}
+
+  void start(const std::string& msg) {
+    data = msg;
+    _pos = 0;
+    _state = FIRST;
+    _useHs = false;
+  }
+
+  bool done() { return _state == IDLE; }
+
+  void step() {
+    if (_wait) {
+      _wait--;
+      return;
+    }
+    switch (_state) {
+      case IDLE:
+        break;
+      case FIRST:             // Interlocked: wait for a ready listener
+        if (asserted(B_NDAC) && !asserted(B_NRFD)) {
+          put();
+          _state = ACCEPT;
+        }
+        break;
+      case ACCEPT:            // Interlocked: wait for the byte to be accepted
+        if (!asserted(B_NDAC)) {
+          devLines = 0;
+          devData = 0;
+          next(CHECK);
+        }
+        break;
+      case CHECK:             // Does the listener accept HS488?
+        if (!asserted(B_NRFD)) {
+          _useHs = _hs && !asserted(B_NDAC);
+          _state = _useHs ? PULSE_WAIT : FIRST;
+        }
+        break;
+      case PULSE_WAIT:        // HS488: wait for NRFD unasserted
+        if (asserted(B_NDAC)) {
+          _state = FIRST;
+        } else if (!asserted(B_NRFD)) {
+          put();
+          _state = PULSE;
+          _wait = 10 * 1000 / STEP_NS;
+        }
+        break;
+      case PULSE:             // HS488: end of the DAV pulse
+        devLines = 0;
+        devData = 0;
+        next(PULSE_WAIT);
+        break;
+    }
+  }
+
+private:
+  enum { IDLE, FIRST, ACCEPT, CHECK, PULSE_WAIT, PULSE };
+
+  void put() {
+    devData = data[_pos];
+    devLines = B_DAV | ((_pos == data.size() - 1) ? B_EOI : 0);
+  }
+
+  void next(uint8_t state) {
+    _pos++;
+    _state = (_pos < data.size()) ? state : IDLE;
+    _wait = 2000 / STEP_NS;
+  }
+
+  bool _hs;
+  bool _useHs;
+  size_t _pos;
+  uint8_t _state;
+  uint32_t _wait;
+};
+
+
+/***** Collects received data *****/
+class BUFSTREAM : public Stream
+{
+public:
+  std::string data;
+
+  int    available() { return 0; }
+  int    peek() { return -1; }
+  int    read() { return -1; }
+  size_t write(const uint8_t db) { data += (char)db; return 1; }
+  using Print::write;
+};
+
+
+/*****************/
+/***** TESTS *****/
+/*****************/
+
+static int failed = 0;
+
+static void result(const char *name, bool ok) {
+  printf("%s: %s\n", ok ? "pass" : "FAIL", name);
+  if (!ok) failed++;
+}
+
+
+static std::string randomMessage() {
+  std::string msg;
+  size_t len = 2 + rnd(120);
+  for (size_t i = 0; i < len; i++) msg += (char)rnd(256);
+  return msg;
+}
+
+
+/***** The interface sends messages to the simulated listener *****/
+static void testSend(const char *name, bool hsListener, uint32_t isrUs, bool expectHs) {
+  GPIBbus bus;
+  SimListener listener(hsListener);
+  std::string sent;
+  bool ok = true;
+
+  simReset(&listener, isrUs);
+  listener.reset();
+  bus.startDeviceMode();
+  bus.cfg.eoi = true;
+  bus.cfg.eos = 3;
+  bus.hs488 = true;
+
+  for (int n = 0; n < 200; n++) {
+    std::string msg = randomMessage();
+    bus.sendData((char *)msg.data(), msg.size());
+    sent += msg;
+    bus.setControls(DIDS);
+    simAdvance(200000);
+  }
+  if (listener.data != sent) ok = false;
+  if (expectHs != (bus.hsBytes > 0)) ok = false;
+  dev = NULL;
+  result(name, ok);
+}
+
+
+/***** The interface receives messages from the simulated talker *****/
+static void testReceive(const char *name, bool hsTalker, bool listTalker, uint32_t isrUs, bool expectHs) {
+  GPIBbus bus;
+  SimTalker talker(hsTalker);
+  BUFSTREAM out;
+  std::string sent;
+  bool ok = true;
+
+  simReset(&talker, isrUs);
+  bus.startDeviceMode();
+  bus.hs488 = true;
+  bus.hsTalkers = listTalker ? (1UL << HS_ANY_TALKER) : 0;
+
+  for (int n = 0; n < 200; n++) {
+    std::string msg = randomMessage();
+    talker.start(msg);
+    sent += msg;
+    bus.receiveData(out, true, false, 0);
+    if (!talker.done()) ok = false;
+    bus.setControls(DIDS);
+    simAdvance(200000);
+  }
+  if (out.data != sent) ok = false;
+  if (expectHs != (bus.hsBytes > 0)) ok = false;
+  dev = NULL;
+  result(name, ok);
+}
+
+
+int main() {
+  testSend("send to HS488 listener", true, 0, true);
+  testSend("send to HS488 listener with interrupts", true, 300, true);
+  testSend("send to interlocked listener with interrupts", false, 300, false);
+  testReceive("receive from listed HS488 talker", true, true, 0, true);
+  testReceive("receive from listed HS488 talker with interrupts", true, true, 300, true);
+  testReceive("receive from unlisted HS488 talker", true, false, 300, false);
+  testReceive("receive from interlocked talker", false, false, 300, false);
+
+  if (failed) {
+    printf("%d test(s) failed\n", failed);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Conversion test for the numeric conversion stream (NUMSTREAM).
+ *
+ * Converts decimal numbers with NUMSTREAM and compares the single and
+ * double precision results with those of strtof() and strtod() on the
+ * host. Runs on the host:
+ *
+ *   g++ -std=gnu++11 -I. -D__AVR_ATmega328P__ -DUSE_NUMCONV \
+ *       numstream_test.cpp ../../AR488/AR488_ComPorts.cpp -o numstream_test
+ *   ./numstream_test
+ */
+#include <Arduino.h>
+#include <math.h>
+#include <float.h>
+#include <string>
+#include "../../AR488/AR488_ComPorts.h"
+
+HardwareSerial Serial;
+
+unsigned long micros() {
+  return 0;
+}
+
+
+/***** Collects the converted output *****/
+class BUFSTREAM : public Stream
+{
+public:
+  std::string data;
+
+  int    available() { return 0; }
+  int    peek() { return -1; }
+  int    read() { return -1; }
+  size_t write(const uint8_t db) { data += (char)db; return 1; }
+  using Print::write;
+};
+
+
+static uint64_t seed = 1;
+
+static uint32_t rnd() {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return seed >> 32;
+}
+
+
+/***** Convert a string with NUMSTREAM, return the value bits *****/
+static uint64_t convert(const char *str, uint8_t format) {
+  BUFSTREAM out;
+  NUMSTREAM num;
+  uint64_t bits = 0;
+
+  num.begin(out, format);
+  while (*str) num.write((uint8_t)*str++);
+  num.end();
+  for (size_t i = out.data.size(); i > 0; i--) bits = (bits << 8) | (uint8_t)out.data[i - 1];
+  return bits;
+}
+
+
+static int failed = 0;
+static long checked = 0;
+
+/***** Compare with strtof() and strtod() *****/
+static void check(const char *str) {
+  float f = strtof(str, NULL);
+  double d = strtod(str, NULL);
+  uint32_t fbits;
+  uint64_t dbits;
+
+  memcpy(&fbits, &f, 4);
+  memcpy(&dbits, &d, 8);
+  if (convert(str, NUM_FLOAT32) != fbits) {
+    if (failed < 20) printf("FAIL: %s single precision\n", str);
+    failed++;
+  }
+  if (convert(str, NUM_FLOAT64) != dbits) {
+    if (failed < 20) printf("FAIL: %s double precision\n", str);
+    failed++;
+  }
+  checked++;
+}
+
+
+/***** A random number with the given digits and exponent *****/
+static void checkRandom(int digits, int exp) {
+  char str[48];
+  int n = 0;
+
+  if (rnd() & 1) str[n++] = '-';
+  str[n++] = '1' + rnd() % 9;
+  str[n++] = '.';
+  for (int i = 1; i < digits; i++) str[n++] = '0' + rnd() % 10;
+  snprintf(str + n, sizeof(str) - n, "E%+d", exp);
+  check(str);
+}
+
+
+/***** The number halfway between a value and the next, to 19 digits *****/
+static void checkHalfway(double d, int prec) {
+  char str[48];
+  long double h = ((long double)d + (long double)nextafter(d, INFINITY)) / 2;
+
+  snprintf(str, sizeof(str), "%.*LE", prec - 1, h);
+  check(str);
+}
+
+
+int main() {
+  const char *fixed[] = {
+    "0", "-0", "1", "+1.23456789E+00", "123", "-1.5", "0.000125", ".5",
+    "8.4E-30", "4.2E-30", "1e-38", "1.17549435E-38", "1.4E-45", "7E-46",
+    "7.1E-46", "3.4028235E+38", "3.4028236E+38", "3.5E+38",
+    "9007199254740993", "9007199254740992.5", "9007199254740993.0000001",
+    "16777217", "16777219", "2.2250738585072011E-308", "2.2250738585072014E-308",
+    "4.9406564584124654E-324", "2.4703282292062327E-324", "2.4703282292062328E-324",
+    "1.7976931348623157E+308", "1.7976931348623158E+308", "1.7976931348623159E+308",
+    "1E-400", "1E+400", "12345678901234567890123", "0.1234567890123456789012",
+    "9999999999999999999", "1E+22", "1E+23", "5E-324", "1E-325",
+  };
+
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) check(fixed[i]);
+
+  // Random numbers over the whole range of double precision
+  for (int n = 0; n < 200000; n++) {
+    checkRandom(1 + rnd() % 19, (int)(rnd() % 660) - 340);
+  }
+  // Random numbers around the range of single precision
+  for (int n = 0; n < 100000; n++) {
+    checkRandom(1 + rnd() % 19, (int)(rnd() % 100) - 50);
+  }
+  // Numbers close to halfway between two values
+  for (int n = 0; n < 100000; n++) {
+    uint64_t bits = ((uint64_t)rnd() << 32) | rnd();
+    double d;
+    float f;
+    bits &= 0x7FFFFFFFFFFFFFFFULL;
+    memcpy(&d, &bits, 8);
+    if (isfinite(d)) checkHalfway(d, 17 + n % 3);
+    f = (float)ldexp((double)(rnd() | 1), (int)(rnd() % 280) - 180);
+    if (isfinite(f)) checkHalfway(f, 9 + n % 11);
+  }
+
+  if (failed) {
+    printf("%d of %ld test(s) failed\n", failed, checked);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Round trip test for the compression stream (ZSTREAM).
+ *
+ * Compresses test data with ZSTREAM, decompresses it with a decoder
+ * written from the format described in AR488_ComPorts.h and checks
+ * that the result matches the input. Runs on the host:
+ *
+ *   g++ -std=gnu++11 -I. -D__AVR_ATmega328P__ -DUSE_COMPRESSION \
+ *       zstream_test.cpp ../../AR488/AR488_ComPorts.cpp -o zstream_test
+ *   ./zstream_test
+ */
+#include <Arduino.h>
+#include <string>
+#include "../../AR488/AR488_ComPorts.h"
+
+HardwareSerial Serial;
+
+unsigned long micros() {
+  return 0;
+}
+
+
+/***** Collects the compressed output *****/
+class BUFSTREAM : public Stream
+{
+public:
+  std::string data;
+
+  int    available() { return 0; }
+  int    peek() { return -1; }
+  int    read() { return -1; }
+  size_t write(const uint8_t db) { data += (char)db; return 1; }
+  using Print::write;
+};
+
+
+/***** Decode a sequence of frames, return false on a format error *****/
+static bool decode(const std::string& in, std::string& out) {
+  std::string frame;
+  size_t i = 0;
+
+  while (i < in.size()) {
+    uint8_t tok = in[i++];
+    if (tok == ZEND) {
+      out += frame;
+      frame.clear();
+    } else if (tok < ZEND) {
+      if (i + tok + 1 > in.size()) return false;
+      frame.append(in, i, tok + 1);
+      i += tok + 1;
+    } else {
+      if (i >= in.size()) return false;
+      size_t len = (tok & 0x7F) + ZMINMATCH;
+      size_t dist = (uint8_t)in[i++] + 1;
+      if (dist > frame.size()) return false;
+      for (size_t n = 0; n < len; n++) frame += frame[frame.size() - dist];
+    }
+  }
+  // Every frame must be terminated
+  return frame.empty();
+}
+
+
+static uint32_t seed = 1;
+
+static uint8_t rnd() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+
+/***** Hash of the three bytes at pos, as computed by ZSTREAM *****/
+static uint8_t zhash(const std::string& data, size_t pos) {
+  return ( ((uint8_t)data[pos] << 4) ^ ((uint8_t)data[pos + 1] << 2) ^ (uint8_t)data[pos + 2] ) & (ZHASHSIZE - 1);
+}
+
+
+/***** Do only the first three bytes and the three at dist have hash h? *****/
+static bool hashOnlyAt(const std::string& data, uint8_t h, size_t dist) {
+  if (zhash(data, dist) != h) return false;
+  for (size_t i = 1; i < dist; i++) {
+    if (zhash(data, i) == h) return false;
+  }
+  return true;
+}
+
+
+static int failed = 0;
+
+/***** Compress the frames, decode them and compare *****/
+static void check(const char *name, const std::string& data, size_t frameLen) {
+  BUFSTREAM zout;
+  ZSTREAM zstream;
+  std::string out;
+
+  for (size_t start = 0; start < data.size(); start += frameLen) {
+    zstream.begin(zout);
+    for (size_t i = start; (i < start + frameLen) && (i < data.size()); i++) {
+      zstream.write((uint8_t)data[i]);
+    }
+    zstream.end();
+  }
+  if (!decode(zout.data, out) || (out != data)) {
+    printf("FAIL: %s\n", name);
+    failed++;
+  }
+}
+
+
+int main() {
+  char name[48];
+
+  // Random data from small alphabets, which gives many short matches
+  for (int n = 0; n < 3000; n++) {
+    std::string data;
+    size_t len = 1 + (rnd() | (rnd() << 8)) % 2000;
+    uint8_t alpha = 2 + rnd() % 16;
+    for (size_t i = 0; i < len; i++) data += (char)('a' + rnd() % alpha);
+    snprintf(name, sizeof(name), "random %d", n);
+    check(name, data, (n & 1) ? len : 1 + rnd() % 300);
+  }
+
+  // Three bytes that match, or only share a hash with, the three bytes
+  // dist back, at the edge of the history window
+  for (size_t dist = 250; dist <= 255; dist++) {
+    for (int kind = 0; kind < 3; kind++) {
+      std::string data;
+      uint8_t h;
+      do {
+        data.clear();
+        for (size_t i = 0; i < dist + 3; i++) data += (char)rnd();
+        if (kind == 0) {
+          // The same three bytes
+          data.replace(dist, 3, data, 0, 3);
+        } else if (kind == 1) {
+          // Different bytes with the same hash
+          data.replace(dist, 3, data, 0, 3);
+          data[dist] ^= 0x04;
+        } else if (dist == 254) {
+          // Different bytes with the same hash, that equal the window
+          // slots of the older bytes once the new ones are written
+          data[0] = data[2] ^ 0x04;
+          data[dist] = data[2];
+          data[dist + 1] = data[1];
+          data[dist + 2] = data[2];
+        } else {
+          // As above, for a distance of 255
+          data[1] = data[2];
+          data[0] = data[2] ^ 0x04;
+          data[dist] = data[2];
+          data[dist + 1] = data[2];
+          data[dist + 2] = data[2];
+        }
+        h = zhash(data, 0);
+      } while (!hashOnlyAt(data, h, dist));
+      for (size_t i = 0; i < 16; i++) data += (char)rnd();
+      snprintf(name, sizeof(name), "distance %u case %d", (unsigned)dist, kind);
+      check(name, data, data.size());
+    }
+  }
+
+  // Runs, literals only, empty frames and data much longer than the window
+  check("run", std::string(1000, 'x'), 1000);
+  {
+    std::string data;
+    for (int i = 0; i < 600; i++) data += (char)i;
+    check("literals", data, data.size());
+  }
+  check("empty", std::string(), 1);
+  {
+    std::string data;
+    for (int i = 0; i < 20000; i++) data += (char)('0' + rnd() % 10);
+    check("long", data, data.size());
+  }
+
+  if (failed) {
+    printf("%d test(s) failed\n", failed);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}